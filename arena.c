@@ -0,0 +1,97 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+
+// Size for calloc
+#define CSIZE 1
+
+// Every allocation is rounded up to a multiple of this
+#define ALIGNMENT (sizeof(max_align_t))
+
+struct block;
+typedef struct block block;
+
+// Blocks form a list, newest first. The memory handed out follows the header.
+struct block{
+	block * next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+};
+
+struct arena_t{
+	block * blocks;
+	size_t blocksize;
+};
+
+static size_t align_size(size_t size){
+	return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// Function to add a block with room for at least size bytes. Blocks come
+// from calloc, so their memory is already zeroed.
+static block * new_block(arena_t * a, size_t size){
+	block * b = calloc(CSIZE, sizeof(block) + size);
+	b->size = size;
+	b->used = 0;
+	b->next = a->blocks;
+	a->blocks = b;
+	return b;
+}
+
+arena_t * arena_create(size_t blocksize){
+	assert(blocksize > 0);
+	arena_t * a = calloc(CSIZE, sizeof(arena_t));
+	a->blocks = NULL;
+	a->blocksize = align_size(blocksize);
+	return a;
+}
+
+void arena_destroy(arena_t * a){
+	assert(a);
+	block * b = a->blocks;
+	while(b){
+		block * next = b->next;
+		free(b);
+		b = next;
+	}
+	free(a);
+}
+
+void * arena_alloc(arena_t * a, size_t size){
+	assert(a);
+	size = align_size(size);
+	if(size > a->blocksize / 4){
+		// Big allocations get their own block, which goes behind the
+		// current one so the space left in it isn't lost
+		block * big = new_block(a, size);
+		a->blocks = big->next;
+		if(a->blocks){
+			big->next = a->blocks->next;
+			a->blocks->next = big;
+		} else {
+			big->next = NULL;
+			a->blocks = big;
+		}
+		big->used = size;
+		return big->data;
+	}
+
+	block * b = a->blocks;
+	if(!b || b->size - b->used < size){
+		b = new_block(a, a->blocksize);
+	}
+	void * mem = (char *)b->data + b->used;
+	b->used += size;
+	return mem;
+}
+
+char * arena_strdup(arena_t * a, const char * str){
+	assert(str);
+	size_t length = strlen(str) + 1;
+	char * copy = arena_alloc(a, length);
+	memcpy(copy, str, length);
+	return copy;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Bump allocator for memory that lives as long as the structure owning it.
+ * Allocations are carved out of large blocks and can't be freed one by one;
+ * everything is released at once by arena_destroy.
+ */
+
+struct arena_t;
+typedef struct arena_t arena_t;
+
+// Create an arena which allocates blocksize bytes from the system at a time.
+// Requests larger than a quarter of blocksize get a block of their own.
+arena_t * arena_create(size_t blocksize);
+
+// Frees every block of the arena, and with it everything allocated from it
+void arena_destroy(arena_t * a);
+
+// Returns size bytes of zeroed memory, aligned for any type
+void * arena_alloc(arena_t * a, size_t size);
+
+// Returns a copy of str allocated from the arena
+char * arena_strdup(arena_t * a, const char * str);
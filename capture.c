@@ -0,0 +1,341 @@
+#define _POSIX_C_SOURCE 200809L
+#include "capture.h"
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+
+#define CSIZE 1
+// Size of the buffer pipes are read through
+#define READ_BUFSIZE (64 * 1024)
+// Most events handled per epoll_wait call
+#define MAX_EVENTS 16
+// Initial size of the output buffers, will allocate more if needed
+#define INITOUTPUT 4096
+// epoll data of the signalfd; pipes have twice the number of their slot,
+// plus 1 for stderr
+#define SIGNAL_EVENT UINT32_MAX
+// No job is the console job
+#define NO_SLOT UINT_MAX
+
+// One of the two pipes of a slot, and what was read from it
+typedef struct stream{
+	int read_fd;
+	int write_fd;             // Passed to the commands, never closed early
+	char * data;
+	size_t len;
+	size_t size;
+} stream;
+
+// Output of the job in one slot
+typedef struct slot_output{
+	stream out;               // stdout, and mymake's messages about the job
+	stream err;               // stderr
+	bool active;              // A job is using the slot
+	unsigned long started;    // When the job started, counted in jobs
+} slot_output;
+
+// Output of a finished job, waiting for the console job to finish
+typedef struct held_output{
+	char * out;
+	size_t outlen;
+	char * err;
+	size_t errlen;
+} held_output;
+
+struct capture_t{
+	FILE * output;
+	FILE * error;
+	slot_output * slots;
+	unsigned int nslots;
+	int epoll;
+	int sigfd;
+	sigset_t oldmask;         // Signal mask from before capture_create
+	bool live;
+	unsigned int console;     // Slot of the console job, NO_SLOT if none
+	unsigned long started;    // Jobs started so far
+	held_output * held;
+	unsigned int hcount;
+	unsigned int hsize;
+	char * readbuf;
+};
+
+// Writes len bytes of data to f right away
+static void emit(FILE * f, const char * data, size_t len){
+	if(len == 0){
+		return;
+	}
+	fwrite(data, 1, len, f);
+	fflush(f);
+}
+
+// Writes out what was captured in slot so far, stdout first
+static void emit_slot(capture_t * c, slot_output * s){
+	emit(c->output, s->out.data, s->out.len);
+	emit(c->error, s->err.data, s->err.len);
+	s->out.len = 0;
+	s->err.len = 0;
+}
+
+static void append(stream * s, const char * data, size_t len){
+	if(s->len + len > s->size){
+		s->size = s->size ? s->size : INITOUTPUT;
+		while(s->len + len > s->size){
+			s->size *= 2;
+		}
+		s->data = realloc(s->data, s->size);
+	}
+	memcpy(s->data + s->len, data, len);
+	s->len += len;
+}
+
+// Reads what the commands of slot wrote so far to one of its pipes
+static void pump_stream(capture_t * c, unsigned int slot, bool error){
+	stream * s = error ? &c->slots[slot].err : &c->slots[slot].out;
+	while(true){
+		ssize_t n = read(s->read_fd, c->readbuf, READ_BUFSIZE);
+		if(n > 0){
+			if(slot == c->console){
+				emit(error ? c->error : c->output, c->readbuf, n);
+			} else {
+				append(s, c->readbuf, n);
+			}
+		} else if(n < 0 && errno == EINTR){
+			continue;
+		} else {
+			// Nothing more for now
+			return;
+		}
+	}
+}
+
+// Reads what the commands of slot wrote so far
+static void pump(capture_t * c, unsigned int slot){
+	pump_stream(c, slot, false);
+	pump_stream(c, slot, true);
+}
+
+// Creates a pipe whose ends aren't inherited by commands, and whose
+// read end doesn't block
+static bool make_pipe(int fds[2]){
+	if(pipe(fds) != 0){
+		return false;
+	}
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	return true;
+}
+
+// Creates the pipe of a stream and adds it to the epoll set with the given
+// data
+static bool open_stream(capture_t * c, stream * s, uint32_t data){
+	int fds[2];
+	if(!make_pipe(fds)){
+		return false;
+	}
+	s->read_fd = fds[0];
+	s->write_fd = fds[1];
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u32 = data;
+	return epoll_ctl(c->epoll, EPOLL_CTL_ADD, fds[0], &ev) == 0;
+}
+
+static void close_stream(stream * s){
+	if(s->read_fd >= 0){
+		close(s->read_fd);
+		close(s->write_fd);
+	}
+	free(s->data);
+}
+
+capture_t * capture_create(FILE * output, FILE * error, unsigned int slots, bool live){
+	capture_t * c = calloc(CSIZE, sizeof(capture_t));
+	c->output = output;
+	c->error = error;
+	c->live = live;
+	c->console = NO_SLOT;
+	c->nslots = slots;
+	c->slots = calloc(slots, sizeof(slot_output));
+	c->readbuf = malloc(READ_BUFSIZE);
+	for(unsigned int i = 0; i < slots; i++){
+		c->slots[i].out.read_fd = -1;
+		c->slots[i].out.write_fd = -1;
+		c->slots[i].err.read_fd = -1;
+		c->slots[i].err.write_fd = -1;
+	}
+
+	// Exits are read from sigfd, so SIGCHLD mustn't be delivered
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &c->oldmask);
+	c->sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	c->epoll = epoll_create1(EPOLL_CLOEXEC);
+	if(c->sigfd < 0 || c->epoll < 0){
+		capture_destroy(c);
+		return NULL;
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u32 = SIGNAL_EVENT;
+	if(epoll_ctl(c->epoll, EPOLL_CTL_ADD, c->sigfd, &ev) != 0){
+		capture_destroy(c);
+		return NULL;
+	}
+	for(unsigned int i = 0; i < slots; i++){
+		if(!open_stream(c, &c->slots[i].out, i * 2) ||
+		   !open_stream(c, &c->slots[i].err, i * 2 + 1)){
+			capture_destroy(c);
+			return NULL;
+		}
+	}
+	return c;
+}
+
+// Writes out the jobs that finished while the console job ran
+static void emit_held(capture_t * c){
+	for(unsigned int i = 0; i < c->hcount; i++){
+		emit(c->output, c->held[i].out, c->held[i].outlen);
+		emit(c->error, c->held[i].err, c->held[i].errlen);
+		free(c->held[i].out);
+		free(c->held[i].err);
+	}
+	c->hcount = 0;
+}
+
+void capture_destroy(capture_t * c){
+	emit_held(c);
+	for(unsigned int i = 0; i < c->nslots; i++){
+		slot_output * s = &c->slots[i];
+		if(s->out.read_fd >= 0 && s->err.read_fd >= 0){
+			pump(c, i);
+		}
+		emit_slot(c, s);
+		close_stream(&s->out);
+		close_stream(&s->err);
+	}
+	if(c->sigfd >= 0) close(c->sigfd);
+	if(c->epoll >= 0) close(c->epoll);
+	sigprocmask(SIG_SETMASK, &c->oldmask, NULL);
+	free(c->held);
+	free(c->slots);
+	free(c->readbuf);
+	free(c);
+}
+
+void capture_start(capture_t * c, unsigned int slot){
+	assert(slot < c->nslots && !c->slots[slot].active);
+	slot_output * s = &c->slots[slot];
+	s->active = true;
+	s->started = c->started;
+	s->out.len = 0;
+	s->err.len = 0;
+	c->started++;
+	if(c->live && c->console == NO_SLOT){
+		c->console = slot;
+	}
+}
+
+int capture_fd(capture_t * c, unsigned int slot){
+	return c->slots[slot].out.write_fd;
+}
+
+int capture_error_fd(capture_t * c, unsigned int slot){
+	return c->slots[slot].err.write_fd;
+}
+
+void capture_print(capture_t * c, unsigned int slot, const char * text, size_t len){
+	if(slot == c->console){
+		emit(c->output, text, len);
+	} else {
+		append(&c->slots[slot].out, text, len);
+	}
+}
+
+pid_t capture_wait(capture_t * c, int * status, int timeout_ms){
+	struct epoll_event events[MAX_EVENTS];
+	while(true){
+		pid_t pid = waitpid(-1, status, WNOHANG);
+		if(pid != 0){
+			return pid;
+		}
+
+		int count = epoll_wait(c->epoll, events, MAX_EVENTS, timeout_ms);
+		if(count < 0){
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		if(count == 0){
+			return 0;
+		}
+		for(int i = 0; i < count; i++){
+			if(events[i].data.u32 == SIGNAL_EVENT){
+				// Several exits can share one signal, waitpid finds them all
+				struct signalfd_siginfo info;
+				while(read(c->sigfd, &info, sizeof(info)) > 0);
+			} else {
+				pump_stream(c, events[i].data.u32 / 2, events[i].data.u32 % 2);
+			}
+		}
+	}
+}
+
+void capture_finish(capture_t * c, unsigned int slot){
+	slot_output * s = &c->slots[slot];
+	pump(c, slot);
+	s->active = false;
+
+	if(c->console != NO_SLOT && slot != c->console){
+		// Its turn comes after the console job
+		if(s->out.len == 0 && s->err.len == 0){
+			return;
+		}
+		if(c->hcount == c->hsize){
+			c->hsize = c->hsize ? c->hsize * 2 : c->nslots;
+			c->held = realloc(c->held, c->hsize * sizeof(held_output));
+		}
+		held_output * h = &c->held[c->hcount];
+		h->out = s->out.data;
+		h->outlen = s->out.len;
+		h->err = s->err.data;
+		h->errlen = s->err.len;
+		c->hcount++;
+		s->out.data = NULL;
+		s->out.len = 0;
+		s->out.size = 0;
+		s->err.data = NULL;
+		s->err.len = 0;
+		s->err.size = 0;
+		return;
+	}
+
+	emit_slot(c, s);
+	if(slot != c->console){
+		return;
+	}
+
+	// The console job is done: write out the jobs that finished meanwhile,
+	// then hand the console to the oldest job still running
+	emit_held(c);
+	c->console = NO_SLOT;
+	for(unsigned int i = 0; i < c->nslots; i++){
+		if(c->slots[i].active &&
+		   (c->console == NO_SLOT || c->slots[i].started < c->slots[c->console].started)){
+			c->console = i;
+		}
+	}
+	if(c->console != NO_SLOT){
+		emit_slot(c, &c->slots[c->console]);
+	}
+}
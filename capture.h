@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+ * Captures the output of the recipes running in each job slot, so that the
+ * output of recipes running at the same time isn't mixed together. Every
+ * slot has a pipe its commands write their stdout to, and another for their
+ * stderr. The pipes are read into two buffers per slot while waiting for
+ * commands to exit, and when its job is done a slot's stdout buffer is
+ * written to the output in one piece, then its stderr buffer to the error
+ * stream.
+ *
+ * In live mode one job at a time, the one that started first, is the
+ * console job: its output goes straight through as it comes. Jobs that
+ * finish while it runs are written out after it, in the order they
+ * finished.
+ *
+ * Commands are waited for with epoll and a signalfd for SIGCHLD, which is
+ * blocked for as long as the capture_t exists.
+ */
+
+struct capture_t;
+typedef struct capture_t capture_t;
+
+// Returns NULL if the pipes can't be set up
+capture_t * capture_create(FILE * output, FILE * error, unsigned int slots, bool live);
+
+// Writes out any output that is left and unblocks SIGCHLD
+void capture_destroy(capture_t * c);
+
+// A new job takes slot
+void capture_start(capture_t * c, unsigned int slot);
+
+// File descriptor the commands of slot write their stdout to
+int capture_fd(capture_t * c, unsigned int slot);
+
+// File descriptor the commands of slot write their stderr to
+int capture_error_fd(capture_t * c, unsigned int slot);
+
+// Adds len bytes of text to the output of slot, for mymake's own messages
+// about the job (like the commands it runs)
+void capture_print(capture_t * c, unsigned int slot, const char * text, size_t len);
+
+// Waits for a command to exit, reading the output of all slots meanwhile.
+// Returns its pid and sets status like waitpid, 0 if nothing exited within
+// timeout_ms milliseconds (-1 waits as long as it takes), or -1 on error.
+pid_t capture_wait(capture_t * c, int * status, int timeout_ms);
+
+// The job in slot is done, so its output is written out (or queued behind
+// the console job)
+void capture_finish(capture_t * c, unsigned int slot);
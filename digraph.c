@@ -1,22 +1,60 @@
 #include "digraph.h"
+#include "arena.h"
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
 #include <assert.h>
 
 // Initial size, will allocate more if necessary
 #define INITSIZE 10
 // Size for calloc
 #define CSIZE 1
+// Nodes are allocated from an arena in blocks of this many bytes
+#define NODE_BLOCKSIZE (64 * 1024)
+// Same for the arrays of links added since the last freeze
+#define LINK_BLOCKSIZE (64 * 1024)
+// Initial size of those arrays, will allocate more if necessary
+#define INITLINKS 4
 
 struct vararray;
 typedef struct vararray vararray;
 
+// A link as stored in a node: the id of the node at its other end, and the
+// position of the same link among the links of that node the other way
+// around, so that either copy of a link leads straight to the other
+typedef struct link_entry{
+	uint32_t node;
+	uint32_t partner;
+} link_entry;
+
+// Links of a node that aren't in the frozen arrays, allocated from the link
+// arena of the digraph
+typedef struct link_array{
+	unsigned int cursize;
+	unsigned int maxsize;
+	link_entry list[];
+} link_array;
+
+// Frozen links of every node in one direction, in CSR form: those of node i
+// are edges[offsets[i]] up to (but not including) edges[ends[i]], as node
+// ids, and partners[e] is where the same link is in the other direction.
+// Removing a link only moves ends[i] down, so offsets[i + 1] can be past it.
+typedef struct csr{
+	uint32_t * offsets;
+	uint32_t * ends;
+	uint32_t * edges;
+	uint32_t * partners;
+} csr;
+
 // Node structure
 struct digraph_node_t{
-	vararray * children;
-	unsigned int num_incoming_nodes;
+	link_array * children; // Links not in the frozen arrays; NULL if none
+	link_array * parents;  // Same for the nodes linking to this one
 	void * nodedata;
+	uint32_t id;           // Position of the node in digraph_t nodes
 };
 
 
@@ -29,10 +67,27 @@ struct vararray{
 
 
 // Entire graph structure. Will store each node in the array and have nodes
-// point to each other as needed.
+// point to each other as needed. A destroyed node leaves a NULL in the
+// array for good, so the ids of the others never change.
+//
+// Once frozen, the links of the first frozen_count nodes are stored in CSR
+// form, outgoing ones in out and incoming ones in in. Links added after
+// freezing go to the node's children and parents arrays and come after its
+// frozen links. Every link is stored once in each direction, both copies
+// frozen or neither, and each copy knows where the other one is, so a link
+// found from one end is removed from the other without searching.
+// The children and parents arrays all come from the links arena, which
+// every freeze empties, so they are never freed one by one.
 struct digraph_t{
 	vararray * nodes;
+	unsigned int count;    // Nodes that weren't destroyed
 	digraph_destroy_cb_t cb;
+	arena_t * arena;       // Memory of the node structs
+	arena_t * links;       // Memory of the children and parents arrays
+	csr out;
+	csr in;
+	unsigned int frozen_count;
+	bool modified;         // Links or nodes changed since the last freeze
 };
 
 
@@ -61,30 +116,6 @@ static void resize_array(vararray * v, bool increase){
 	v->list = realloc(v->list, sizeof(digraph_node_t *) * v->maxsize);
 }
 
-// Function to remove NULL in the middle of an array
-static void shift_array(vararray * v){
-	digraph_node_t ** walker = v->list;
-	unsigned int iterations = 0;
-	while(*walker != NULL && iterations != v->cursize){
-		walker++;
-		iterations++;
-	}
-	if(iterations != v->cursize - 1){
-		// At a null so can shit down
-		while(iterations != v->cursize - 1){
-			*walker = *(walker + 1);
-			walker++;
-			iterations++;
-		}
-	}
-	v->cursize--;
-	if(v->cursize <= v->maxsize / 2){
-		resize_array(v, false);
-	}
-
-	return;
-}
-
 // Internal function to find the specific node
 //static digraph_node_t * find_node(digraph_t * d, digraph_node_t * n){
 //	assert(d);
@@ -99,11 +130,92 @@ static void shift_array(vararray * v){
 //	return (digraph_node_t *) 0
 //}
 
+// Number of links of n stored in the frozen arrays c
+static unsigned int frozen_link_count(const digraph_t * d, const csr * c,
+									  const digraph_node_t * n){
+	if(n->id >= d->frozen_count){
+		return 0;
+	}
+	return c->ends[n->id] - c->offsets[n->id];
+}
+
+// The children of n, or its parents if incoming is set
+static link_array * added_links(const digraph_node_t * n, bool incoming){
+	return incoming ? n->parents : n->children;
+}
+
+// Returns an empty link array with room for size links
+static link_array * new_links(digraph_t * d, unsigned int size){
+	link_array * a = arena_alloc(d->links, sizeof(link_array) +
+								 size * sizeof(link_entry));
+	a->cursize = 0;
+	a->maxsize = size;
+	return a;
+}
+
+// Appends a link to the node with the given id to the array at *a, creating
+// it if needed, and returns its position. A full array is copied into one
+// twice its size; the old one stays in the arena until the next freeze.
+static unsigned int append_link(digraph_t * d, link_array ** a, uint32_t node,
+								uint32_t partner){
+	if(!*a){
+		*a = new_links(d, INITLINKS);
+	}
+	if((*a)->cursize == (*a)->maxsize){
+		link_array * bigger = new_links(d, (*a)->maxsize * 2);
+		memcpy(bigger->list, (*a)->list, (*a)->cursize * sizeof(link_entry));
+		bigger->cursize = (*a)->cursize;
+		*a = bigger;
+	}
+	(*a)->list[(*a)->cursize].node = node;
+	(*a)->list[(*a)->cursize].partner = partner;
+	return (*a)->cursize++;
+}
+
+// Takes the link at position e out of the frozen links of node i in c, by
+// moving the last of them into its place. other is the other direction,
+// where the copy of the moved link is told its new position.
+static void remove_frozen(csr * c, csr * other, uint32_t i, uint32_t e){
+	uint32_t last = --c->ends[i];
+	if(e != last){
+		c->edges[e] = c->edges[last];
+		c->partners[e] = c->partners[last];
+		other->partners[c->partners[e]] = e;
+	}
+}
+
+// Same for the link at position k of the children of n, or of its parents
+// if incoming is set
+static void remove_added(digraph_t * d, digraph_node_t * n, bool incoming, unsigned int k){
+	link_array * a = added_links(n, incoming);
+	unsigned int last = --a->cursize;
+	if(k != last){
+		a->list[k] = a->list[last];
+		link_entry * moved = &a->list[k];
+		added_links(d->nodes->list[moved->node], !incoming)->list[moved->partner].partner = k;
+	}
+}
+
+// Frees the arrays of c
+static void free_csr(csr * c){
+	free(c->offsets);
+	free(c->ends);
+	free(c->edges);
+	free(c->partners);
+}
+
 // Create digraph
 digraph_t * digraph_create(digraph_destroy_cb_t cb){
 	digraph_t * new_digraph = calloc(CSIZE, sizeof(digraph_t));
 	new_digraph->nodes = new_vararray();
+	new_digraph->count = 0;
 	new_digraph->cb = cb;
+	new_digraph->arena = arena_create(NODE_BLOCKSIZE);
+	new_digraph->links = arena_create(LINK_BLOCKSIZE);
+	memset(&new_digraph->out, 0, sizeof(csr));
+	memset(&new_digraph->in, 0, sizeof(csr));
+	new_digraph->frozen_count = 0;
+	new_digraph->modified = false;
 	return new_digraph;
 }
 
@@ -111,91 +223,93 @@ digraph_t * digraph_create(digraph_destroy_cb_t cb){
 void digraph_destroy(digraph_t * graph){
 	assert(graph);
 	for(int i = 0; i < graph->nodes->cursize; i++){
+		digraph_node_t * n = graph->nodes->list[i];
+		if(!n){
+			continue;
+		}
 		if(graph->cb){
-			graph->cb(graph->nodes->list[i]->nodedata);
+			graph->cb(n->nodedata);
 		}
-		free_vararray(graph->nodes->list[i]->children);
-		free(graph->nodes->list[i]);
 	}
+	arena_destroy(graph->arena);
+	arena_destroy(graph->links);
 	free_vararray(graph->nodes);
+	free_csr(&graph->out);
+	free_csr(&graph->in);
 	free(graph);
 }
 
 // Create a digraph node
 digraph_node_t * digraph_node_create(digraph_t * d, void * userdata){
 	// Create the node
-	digraph_node_t * n = calloc(CSIZE, sizeof(digraph_node_t));
-	n->children = new_vararray();
-	n->num_incoming_nodes = 0;
+	// Children are only allocated once the node gets a link
+	digraph_node_t * n = arena_alloc(d->arena, sizeof(digraph_node_t));
+	n->children = NULL;
+	n->parents = NULL;
 	n->nodedata = userdata;
 
 	// Add it to the digraph
+	assert(d->nodes->cursize < UINT32_MAX);
 	if(d->nodes->cursize == d->nodes->maxsize){
 		// resize the array
 		resize_array(d->nodes, true);
 	}
+	n->id = d->nodes->cursize;
 	d->nodes->list[d->nodes->cursize] = n;
 	d->nodes->cursize += 1;
+	d->count++;
+	d->modified = true;
 	return n;
 }
 
-// Destroy digraph node
+// Destroy digraph node. Each of its links is taken out of the node at the
+// other end through the position stored with it, so only its own links are
+// looked at.
 void digraph_node_destroy(digraph_t * d, digraph_node_t * n){
-	// First remove any connections to it
-	int nodeidx = -1;
-	unsigned int graphcount = d->nodes->cursize;
-	digraph_node_t * curnode = NULL;
-
-	if(n->num_incoming_nodes > 0){
-		unsigned int nodecount;
-		for(int i = 0; i < graphcount; i++){
-			curnode = d->nodes->list[i];
-			if(curnode == n){
-				// At node we are looking for, can skip it
-				nodeidx = i;   // but first grab it's position so we don't loop again
-				continue;
-			}
-			nodecount = curnode->children->cursize;
-
-			for(int j = 0; j < nodecount; j++){
-				if(curnode->children->list[j] == n){
-					curnode->children->list[j] = NULL;
-					if(j != nodecount-1){
-						shift_array(curnode->children);  // Altering of array happens here
-					}
-				}
-			}
+	assert(d->nodes->list[n->id] == n);
+	if(n->id < d->frozen_count){
+		csr * out = &d->out;
+		csr * in = &d->in;
+		for(uint32_t e = out->offsets[n->id]; e < out->ends[n->id]; e++){
+			remove_frozen(in, out, out->edges[e], out->partners[e]);
 		}
+		for(uint32_t e = in->offsets[n->id]; e < in->ends[n->id]; e++){
+			remove_frozen(out, in, in->edges[e], in->partners[e]);
+		}
+		out->ends[n->id] = out->offsets[n->id];
+		in->ends[n->id] = in->offsets[n->id];
 	}
-
-	if(nodeidx == -1){
-		// find array
-		for(int i = 0; i < graphcount; i++){
-			curnode = d->nodes->list[i];
-			if(curnode == n){
-				nodeidx = i;
-				break;
-			}
+	if(n->children){
+		for(int i = 0; i < n->children->cursize; i++){
+			link_entry * l = &n->children->list[i];
+			remove_added(d, d->nodes->list[l->node], true, l->partner);
+		}
+	}
+	if(n->parents){
+		for(int i = 0; i < n->parents->cursize; i++){
+			link_entry * l = &n->parents->list[i];
+			remove_added(d, d->nodes->list[l->node], false, l->partner);
 		}
 	}
-	// Just to make sure
-	curnode = d->nodes->list[nodeidx];
 
 	if(d->cb){
-		d->cb(curnode->nodedata);
+		d->cb(n->nodedata);
 	}
-	free_vararray(curnode->children);
-	free(curnode);
-	d->nodes->list[nodeidx] = NULL;
-	shift_array(d->nodes);
+	// The node itself stays in the arena until the graph is destroyed, and
+	// its arrays until the next freeze
+	n->children = NULL;
+	n->parents = NULL;
+	d->nodes->list[n->id] = NULL;
+	d->count--;
+	d->modified = true;
 }
 
 // Visits all the nodes as long as cb returns true
 bool digraph_visit(digraph_t * g, digraph_visit_cb_t cb, void * data){
 	unsigned int count = g->nodes->cursize;
-	if(!count) return false;
+	if(!g->count) return false;
 	for(int i = 0; i < count; i++){
-		if(!cb(g, g->nodes->list[i], data)){
+		if(g->nodes->list[i] && !cb(g, g->nodes->list[i], data)){
 			return false;
 		}
 	}
@@ -207,7 +321,7 @@ bool digraph_visit(digraph_t * g, digraph_visit_cb_t cb, void * data){
 digraph_node_t * digraph_find(digraph_t * g, digraph_visit_cb_t cb, void * userdata){
 	unsigned int count = g->nodes->cursize;
 	for(int i = 0; i < count; i++){
-		if(cb(g, g->nodes->list[i], userdata)){
+		if(g->nodes->list[i] && cb(g, g->nodes->list[i], userdata)){
 			return g->nodes->list[i];
 		}
 	}
@@ -221,13 +335,221 @@ void digraph_add_link(digraph_t * d, digraph_node_t * from, digraph_node_t * to)
 	assert(to);
 	assert(from != to);   // don't connect to yourself
 
-	if(from->children->cursize == from->children->maxsize){
-		resize_array(from->children, true);
+	unsigned int k = append_link(d, &from->children, to->id, 0);
+	from->children->list[k].partner = append_link(d, &to->parents, from->id, k);
+	d->modified = true;
+}
+
+// Remove the links between two nodes. The other links of from move down to
+// close the gaps, so they keep their order; to's side is swapped out.
+unsigned int digraph_remove_link(digraph_t * d, digraph_node_t * from, digraph_node_t * to){
+	assert(d);
+	assert(from);
+	assert(to);
+
+	unsigned int removed = 0;
+	if(from->id < d->frozen_count){
+		csr * out = &d->out;
+		uint32_t kept = out->offsets[from->id];
+		for(uint32_t e = kept; e < out->ends[from->id]; e++){
+			if(out->edges[e] == to->id){
+				remove_frozen(&d->in, out, to->id, out->partners[e]);
+				removed++;
+				continue;
+			}
+			if(kept != e){
+				out->edges[kept] = out->edges[e];
+				out->partners[kept] = out->partners[e];
+				d->in.partners[out->partners[kept]] = kept;
+			}
+			kept++;
+		}
+		out->ends[from->id] = kept;
+	}
+	link_array * children = from->children;
+	if(children){
+		unsigned int kept = 0;
+		for(unsigned int k = 0; k < children->cursize; k++){
+			link_entry * l = &children->list[k];
+			if(l->node == to->id){
+				remove_added(d, to, true, l->partner);
+				removed++;
+				continue;
+			}
+			if(kept != k){
+				children->list[kept] = *l;
+				d->nodes->list[l->node]->parents->list[l->partner].partner = kept;
+			}
+			kept++;
+		}
+		children->cursize = kept;
+	}
+	if(removed > 0){
+		d->modified = true;
+	}
+	return removed;
+}
+
+// A node whose links are being followed by a depth first search
+typedef struct walk_frame{
+	digraph_node_t * node;
+	unsigned int link;     // Next link to follow
+} walk_frame;
+
+// Tarjan's algorithm. The depth first search keeps its own stack of frames
+// instead of recursing, so a long chain of links can't overflow the C
+// stack. A node is on Tarjan's stack while it has an index but no
+// component yet.
+unsigned int digraph_components(digraph_t * d, unsigned int * component){
+	assert(d);
+	unsigned int count = d->nodes->cursize;
+	uint32_t * index = malloc((count + 1) * sizeof(uint32_t));
+	uint32_t * low = malloc((count + 1) * sizeof(uint32_t));
+	uint32_t * stack = malloc((count + 1) * sizeof(uint32_t));
+	walk_frame * frames = malloc((count + 1) * sizeof(walk_frame));
+	unsigned int depth = 0;
+	unsigned int nframes = 0;
+	uint32_t next_index = 0;
+	unsigned int ncomponents = 0;
+
+	for(int i = 0; i < count; i++){
+		index[i] = UINT32_MAX;
+		component[i] = UINT_MAX;
 	}
-	from->children->list[from->children->cursize] = to;
-	to->num_incoming_nodes++;
-	from->children->cursize += 1;
 
+	for(int root = 0; root < count; root++){
+		if(index[root] != UINT32_MAX || !d->nodes->list[root]){
+			continue;
+		}
+		index[root] = low[root] = next_index++;
+		stack[depth++] = root;
+		frames[nframes].node = d->nodes->list[root];
+		frames[nframes].link = 0;
+		nframes++;
+
+		while(nframes > 0){
+			walk_frame * f = &frames[nframes - 1];
+			uint32_t v = f->node->id;
+			digraph_node_t * next = NULL;
+			if(digraph_node_get_link(d, f->node, f->link, &next)){
+				f->link++;
+				uint32_t w = next->id;
+				if(index[w] == UINT32_MAX){
+					index[w] = low[w] = next_index++;
+					stack[depth++] = w;
+					frames[nframes].node = next;
+					frames[nframes].link = 0;
+					nframes++;
+				} else if(component[w] == UINT_MAX && index[w] < low[v]){
+					// Still on the stack, so part of the current component
+					low[v] = index[w];
+				}
+				continue;
+			}
+
+			// Every link of v has been followed
+			nframes--;
+			if(low[v] == index[v]){
+				uint32_t w;
+				do{
+					w = stack[--depth];
+					component[w] = ncomponents;
+				} while(w != v);
+				ncomponents++;
+			}
+			if(nframes > 0){
+				uint32_t parent = frames[nframes - 1].node->id;
+				if(low[v] < low[parent]){
+					low[parent] = low[v];
+				}
+			}
+		}
+	}
+
+	free(index);
+	free(low);
+	free(stack);
+	free(frames);
+	return ncomponents;
+}
+
+// State of digraph_dependency_order
+typedef struct order_walk{
+	digraph_t * d;
+	digraph_visit_cb_t reach;
+	void * userdata;
+	bool * seen;           // By node id
+	walk_frame * frames;
+	unsigned int nframes;
+	uint32_t * order;
+	unsigned int count;
+	unsigned int size;     // Room in each array, more than the node count
+} order_walk;
+
+// n was reached for the first time; its links are followed next, unless
+// the callback says not to
+static void reach_node(order_walk * w, digraph_node_t * n){
+	w->seen[n->id] = true;
+	bool follow = !w->reach || w->reach(w->d, n, w->userdata);
+	if(w->d->nodes->cursize >= w->size){
+		// The callback added nodes
+		unsigned int old = w->size;
+		w->size = w->d->nodes->cursize * 2 + 1;
+		w->seen = realloc(w->seen, w->size * sizeof(bool));
+		memset(w->seen + old, 0, (w->size - old) * sizeof(bool));
+		w->frames = realloc(w->frames, w->size * sizeof(walk_frame));
+		w->order = realloc(w->order, w->size * sizeof(uint32_t));
+	}
+	if(follow){
+		w->frames[w->nframes].node = n;
+		w->frames[w->nframes].link = 0;
+		w->nframes++;
+	} else {
+		w->order[w->count++] = n->id;
+	}
+}
+
+// A depth first search that lists each node once all of its links have
+// been followed, with its own stack of frames instead of recursion
+unsigned int digraph_dependency_order(digraph_t * d, digraph_node_t * const * roots,
+									  unsigned int nroots, digraph_visit_cb_t reach,
+									  void * userdata, uint32_t ** order){
+	assert(d);
+	order_walk w;
+	w.d = d;
+	w.reach = reach;
+	w.userdata = userdata;
+	w.size = d->nodes->cursize + 1;
+	w.seen = calloc(w.size, sizeof(bool));
+	w.frames = malloc(w.size * sizeof(walk_frame));
+	w.nframes = 0;
+	w.order = malloc(w.size * sizeof(uint32_t));
+	w.count = 0;
+
+	for(int r = 0; r < nroots; r++){
+		if(w.seen[roots[r]->id]){
+			continue;
+		}
+		reach_node(&w, roots[r]);
+		while(w.nframes > 0){
+			walk_frame * f = &w.frames[w.nframes - 1];
+			digraph_node_t * next = NULL;
+			if(digraph_node_get_link(d, f->node, f->link, &next)){
+				f->link++;
+				if(!w.seen[next->id]){
+					reach_node(&w, next);
+				}
+			} else {
+				w.order[w.count++] = f->node->id;
+				w.nframes--;
+			}
+		}
+	}
+
+	free(w.seen);
+	free(w.frames);
+	*order = w.order;
+	return w.count;
 }
 
 // Visit each outgoing node
@@ -258,18 +580,47 @@ bool digraph_node_get_link(digraph_t * d, digraph_node_t * n,
 		return false;
 	}
 
-	*ret = n->children->list[idx];
+	unsigned int frozen = frozen_link_count(d, &d->out, n);
+	if(idx < frozen){
+		*ret = d->nodes->list[d->out.edges[d->out.offsets[n->id] + idx]];
+	} else {
+		*ret = d->nodes->list[n->children->list[idx - frozen].node];
+	}
 	return true;
 }
 
 // Return how many outgoing links a node has
 unsigned int digraph_node_outgoing_link_count(const digraph_t * d, const digraph_node_t * n){
-	return n->children->cursize;
+	unsigned int count = frozen_link_count(d, &d->out, n);
+	if(n->children){
+		count += n->children->cursize;
+	}
+	return count;
 }
 
 // Get how many incoming nodes a node has
 unsigned int digraph_node_incoming_link_count(const digraph_t * d, const digraph_node_t * n){
-	return n->num_incoming_nodes;
+	unsigned int count = frozen_link_count(d, &d->in, n);
+	if(n->parents){
+		count += n->parents->cursize;
+	}
+	return count;
+}
+
+// Retrieve the source node of the specified incoming link
+bool digraph_node_get_incoming_link(const digraph_t * d, const digraph_node_t * n,
+									unsigned int idx, digraph_node_t ** ret){
+	if(idx >= digraph_node_incoming_link_count(d, n)){
+		return false;
+	}
+
+	unsigned int frozen = frozen_link_count(d, &d->in, n);
+	if(idx < frozen){
+		*ret = d->nodes->list[d->in.edges[d->in.offsets[n->id] + idx]];
+	} else {
+		*ret = d->nodes->list[n->parents->list[idx - frozen].node];
+	}
+	return true;
 }
 
 // Set the data of a node to a new value and return it's old data
@@ -283,3 +634,104 @@ void * digraph_node_set_data(digraph_t * d, digraph_node_t * n, void * userdata)
 void * digraph_node_get_data(const digraph_t * d, const digraph_node_t * n){
 	return n->nodedata;
 }
+
+
+// Pack every link into one CSR array. Ids of destroyed nodes get no links.
+void digraph_freeze(digraph_t * d){
+	assert(d);
+	if(!d->modified){
+		return;
+	}
+
+	unsigned int count = d->nodes->cursize;
+	csr out;
+	out.offsets = calloc(count + 1, sizeof(uint32_t));
+	uint64_t total = 0;
+	for(int i = 0; i < count; i++){
+		out.offsets[i] = total;
+		if(d->nodes->list[i]){
+			total += digraph_node_outgoing_link_count(d, d->nodes->list[i]);
+			assert(total < UINT32_MAX);
+		}
+	}
+	out.offsets[count] = total;
+	out.ends = malloc((count + 1) * sizeof(uint32_t));
+	memcpy(out.ends, out.offsets + 1, count * sizeof(uint32_t));
+
+	out.edges = calloc(total + 1, sizeof(uint32_t));
+	digraph_node_t * curnode = NULL;
+	for(int i = 0; i < count; i++){
+		digraph_node_t * n = d->nodes->list[i];
+		unsigned int links = out.offsets[i + 1] - out.offsets[i];
+		for(int j = 0; j < links; j++){
+			digraph_node_get_link(d, n, j, &curnode);
+			out.edges[out.offsets[i] + j] = curnode->id;
+		}
+	}
+
+	// The same links the other way around: count the incoming links of each
+	// node, then place them, pairing up the two copies of each link. Once
+	// every link is placed, the fill position of each node is its end.
+	csr in;
+	in.offsets = calloc(count + 1, sizeof(uint32_t));
+	in.edges = calloc(total + 1, sizeof(uint32_t));
+	in.partners = malloc((total + 1) * sizeof(uint32_t));
+	out.partners = malloc((total + 1) * sizeof(uint32_t));
+	for(uint64_t i = 0; i < total; i++){
+		in.offsets[out.edges[i] + 1]++;
+	}
+	for(int i = 0; i < count; i++){
+		in.offsets[i + 1] += in.offsets[i];
+	}
+	in.ends = malloc((count + 1) * sizeof(uint32_t));
+	memcpy(in.ends, in.offsets, (count + 1) * sizeof(uint32_t));
+	for(int i = 0; i < count; i++){
+		for(uint32_t e = out.offsets[i]; e < out.offsets[i + 1]; e++){
+			uint32_t r = in.ends[out.edges[e]]++;
+			in.edges[r] = i;
+			in.partners[r] = e;
+			out.partners[e] = r;
+		}
+	}
+
+	// Only now drop the old storage, which the loops above still read from
+	for(int i = 0; i < count; i++){
+		digraph_node_t * n = d->nodes->list[i];
+		if(!n){
+			continue;
+		}
+		n->children = NULL;
+		n->parents = NULL;
+	}
+	arena_destroy(d->links);
+	d->links = arena_create(LINK_BLOCKSIZE);
+	free_csr(&d->out);
+	free_csr(&d->in);
+	d->out = out;
+	d->in = in;
+	d->frozen_count = count;
+	d->modified = false;
+}
+
+// Return the id of the given node
+unsigned int digraph_node_id(const digraph_t * d, const digraph_node_t * n){
+	return n->id;
+}
+
+// Return the node with the given id
+digraph_node_t * digraph_node_from_id(const digraph_t * d, unsigned int id){
+	if(id >= d->nodes->cursize){
+		return NULL;
+	}
+	return d->nodes->list[id];
+}
+
+// Return how many nodes are in the graph
+unsigned int digraph_node_count(const digraph_t * d){
+	return d->count;
+}
+
+// Return the number all ids are below
+unsigned int digraph_node_id_limit(const digraph_t * d){
+	return d->nodes->cursize;
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 
 struct digraph_node_t;
 
@@ -26,7 +27,10 @@ void digraph_destroy(digraph_t * graph);
 
 digraph_node_t * digraph_node_create(digraph_t * d, void * userdata);
 
-// Remove a node; Calls the destroy function on userdata (if not null)
+// Remove a node; Calls the destroy function on userdata (if not null).
+// Takes time in proportion to the links of the node itself, not to those
+// of the nodes it has links with. Other nodes keep their ids, but the links
+// they had with it are swapped out, so their other links can change order.
 void digraph_node_destroy(digraph_t * d, digraph_node_t * n);
 
 
@@ -51,6 +55,40 @@ digraph_node_t * digraph_find(digraph_t * g, digraph_visit_cb_t cb,
 void digraph_add_link(digraph_t * d, digraph_node_t * from, 
         digraph_node_t * to);
 
+// Remove every link from from to to. Returns how many there were.
+// Takes time in proportion to the outgoing links of from, which keep their
+// order; the incoming links of to can change order.
+unsigned int digraph_remove_link(digraph_t * d, digraph_node_t * from,
+        digraph_node_t * to);
+
+// Splits the graph into its strongly connected components (Tarjan's
+// algorithm, without recursion, in time linear in the nodes and links).
+// Sets component[id] for every node id (UINT_MAX for ids of destroyed
+// nodes); two nodes get the same number exactly when each can reach the
+// other, so a component with more than one node holds a cycle. Components
+// are numbered in reverse topological order: every link goes to a node
+// whose number is lower than or the same as its own. component must have
+// room for digraph_node_id_limit(d) entries. Returns the number of
+// components.
+unsigned int digraph_components(digraph_t * d, unsigned int * component);
+
+// Lists the nodes that can be reached from the roots in dependency order:
+// each node comes after every node it links to, unless they are in a cycle
+// together. Otherwise nodes are in the order a depth first search following
+// the links of each node in turn finishes them, which is the order a
+// recursive walk would handle them in. Done without recursion, in time
+// linear in the nodes and links reached.
+//
+// If reach isn't NULL, it is called on each node when it is first reached,
+// and the links of the node are followed only if it returns true. Unlike
+// other callbacks, it may add nodes, and links from the node it is given.
+//
+// Sets *order to an array of node ids, which the caller frees. Returns the
+// number of ids in it.
+unsigned int digraph_dependency_order(digraph_t * d, digraph_node_t * const * roots,
+        unsigned int nroots, digraph_visit_cb_t reach, void * userdata,
+        uint32_t ** order);
+
 // Visit each outgoing link of the node
 bool digraph_node_visit(digraph_t * d, digraph_node_t * n,
         digraph_visit_cb_t visit, void * userdata);
@@ -69,6 +107,13 @@ unsigned int digraph_node_outgoing_link_count(const digraph_t * d, const digraph
 unsigned int digraph_node_incoming_link_count(const digraph_t * d, const
         digraph_node_t * n);
 
+// Retrieve the source node of the specified incoming link of this node,
+// i.e. a node with a link to it. idx must be
+// [0 ... incoming_link_count(node)-1]. Returns true if so (and sets *ret),
+// false otherwise (and doesn't modify *ret).
+bool digraph_node_get_incoming_link(const digraph_t * d, const digraph_node_t * n,
+        unsigned int idx, digraph_node_t ** ret);
+
 // Set data for given node. Returns the old value
 void * digraph_node_set_data(digraph_t * d, digraph_node_t * n,
         void * userdata);
@@ -76,4 +121,28 @@ void * digraph_node_set_data(digraph_t * d, digraph_node_t * n,
 // Return data associated with node
 void * digraph_node_get_data(const digraph_t * d, const digraph_node_t * n);
 
-        
+// Number of nodes in the graph
+unsigned int digraph_node_count(const digraph_t * d);
+
+// Every node has an id below digraph_node_id_limit(d), which it keeps for
+// as long as it exists. Nodes are numbered from 0 up in the order they were
+// created, and the ids of destroyed nodes aren't used again, so the ids are
+// [0 ... node_count(d)-1] unless nodes were destroyed.
+unsigned int digraph_node_id(const digraph_t * d, const digraph_node_t * n);
+
+// One more than the highest id given out, including to destroyed nodes
+unsigned int digraph_node_id_limit(const digraph_t * d);
+
+// Return the node with the given id, or NULL if there is none (because the
+// node was destroyed)
+digraph_node_t * digraph_node_from_id(const digraph_t * d, unsigned int id);
+
+// Packs the links of all nodes into a single compact array (CSR form, 4
+// bytes per link, plus 4 for the incoming side and 8 more so that either
+// side of a link can find the other) to make traversal cheaper.
+// Meant to be called once the graph is loaded; calling it again when
+// nothing changed does nothing. The graph can still be modified
+// afterwards: new links are stored separately until the next freeze, and
+// links and nodes are removed from the packed arrays in place.
+void digraph_freeze(digraph_t * d);
+
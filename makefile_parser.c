@@ -1,5 +1,10 @@
-#define  _GNU_SOURCE      // Needed for getline
+#define _POSIX_C_SOURCE 200809L    // Needed for mmap
 #include "makefile_parser.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
@@ -8,136 +13,56 @@
 #include <ctype.h>
 
 // Initial values, will allocate more if needed
-//#define MAXARRAY 10    
-#define MAXWORD 50
+#define INITSLICES 8
+#define INITREAD 4096
 #define CSIZE 1    // Size for calloc function
 
-// Structure which will hold variable length words
-struct varstring{
-	char * word;
-	unsigned int wordlength;
-	unsigned int arraylength;
-};
-
-typedef struct varstring varstring;
-
+// Rule target that selects recipes to run in a single shell
+#define ONESHELL_TARGET ".ONESHELL"
 
-// Structure to hold array of varstrings
-struct vararray{
-	varstring ** words;
+// Array of slices, reused from one rule to the next
+struct slice_list{
+	mfp_slice_t * items;
 	unsigned int cursize;
+	unsigned int maxsize;
 };
 
-typedef struct vararray vararray;
-
-static void expand_varstring(varstring * mystr, unsigned int size){
-	unsigned int newsize = size * 2;
-	char * new_array = realloc(mystr->word, sizeof(char)*newsize);
-	mystr->word = new_array;
-	mystr->arraylength = newsize;
-}
-
-
-
-// Function to strip comments from lines
-static ssize_t strip_comments(char ** array, ssize_t length){
-	bool hashtag = false;
-	for(int i = 0; i < length; i++){
-		if(!hashtag){
-			// Check currect character
-			if((*array)[i] == '#'){
-				// See if the previous character is an escape character
-				if(i == 0 || (*array)[i-1] != '\\'){
-					hashtag = true;
-				}
-			}
-		}
-		if(hashtag){
-			(*array)[i] = '\n';
-			(*array)[i+1] = '\0';
-			break;
-		}
-	}
-	ssize_t newlen = strlen(*array);
-	return newlen;
-}
-
-
-// Function to strip beginning whitespace
-static ssize_t strip_whitespace_beg(char ** array, ssize_t length){
-	if((*array)[0] != ' '){
-		return length;
-	}
-	
-	char * walker = *array;
-	while(*walker == ' '){
-		walker++;
-	}
-
-	unsigned int i = 0;
-	while(*walker){
-		(*array)[i] = *walker;
-		walker++;
-		i++;
-	}
-
-	(*array)[i] = '\0';
-	return strlen(*array);
-}
-
-
-// Function to get a new vararray
-static vararray * new_vararray(){
-	vararray * array = malloc(sizeof(vararray));
-//	array->maxsize = MAXARRAY;
-	array->words = NULL;
-	array->cursize = 0;
-	return array;
-}
-
+typedef struct slice_list slice_list;
+
+// State kept while parsing a buffer
+struct parser{
+	const mfp_cb_t * cb;
+	void * extradata;
+	bool inrule;            // See if we are actively in a rule or not
+	unsigned int line;      // Number of the line being parsed
+	slice_list targets;
+	slice_list dependencies;
+	slice_list recipies;
+
+	// Storage used to hand NUL-terminated strings to cb->rule_cb
+	const char ** strings;
+	unsigned int maxstrings;
+	char * text;
+	size_t textsize;
+};
 
-// Function to free vararray
-static void free_vararray(vararray * array){
-	assert(array);
-	if(array->words){
-		// TODO: Free each varstring in array
-		free(array->words);
-	}
-	free(array);
-}
+typedef struct parser parser;
 
-// Function to free the varstring
-static void free_varstring(varstring * mystr){
-	assert(mystr);
-	if(mystr->word){
-		free(mystr->word);
-	}
-	free(mystr);
-}
 
-// Function to free the list of words pointed to by array->words
-static void free_list(vararray * array){
-	assert(array);
-	for(int i = 0; i < array->cursize; i++){
-		free_varstring(array->words[i]);
+// Function to add a slice to the list
+static void add_slice(slice_list * list, const char * str, size_t len){
+	if(list->cursize == list->maxsize){
+		list->maxsize = list->maxsize ? list->maxsize * 2 : INITSLICES;
+		list->items = realloc(list->items, sizeof(mfp_slice_t) * list->maxsize);
 	}
-	free(array->words);
-	array->words = NULL;
-	array->cursize = 0;
-}
-
-// Function for a new varstring
-static varstring * new_varstring(){
-	varstring * new_string = malloc(sizeof(varstring));
-	new_string->wordlength = 0;
-	new_string->arraylength = MAXWORD;
-	new_string->word = calloc(CSIZE, sizeof(char) * new_string->arraylength);
-	return new_string;
+	list->items[list->cursize].str = str;
+	list->items[list->cursize].len = len;
+	list->cursize++;
 }
 
 // Function to check for valid characters
 static bool is_valid_char(char c){
-	if(!isalnum(c) && c != '_' && c != '.' && c != '-' && c != '/'){
+	if(!isalnum(c) && c != '_' && c != '.' && c != '-' && c != '/' && c != '%'){
 			// Not a valid char
 			return false;
 		}
@@ -145,9 +70,9 @@ static bool is_valid_char(char c){
 }
 
 // Checks if a target line is valid
-static bool is_valid_target_line(char * line, ssize_t length){
+static bool is_valid_target_line(const char * line, size_t length){
 	bool hit_colon = false;
-	for(int i = 0; i < length - 1; i++){
+	for(size_t i = 0; i < length; i++){
 		if(line[i] == ':'){
 			if(!hit_colon){
 				hit_colon = true;
@@ -165,248 +90,357 @@ static bool is_valid_target_line(char * line, ssize_t length){
 	return true;
 }
 
-// Function to append character to varstring
-static void append_char(varstring * mystr, char c){
-	assert(mystr);
-	if(mystr->wordlength + 1 >= mystr->arraylength){
-		// Expand the array
-		expand_varstring(mystr, mystr->arraylength);
+// Returns the length of line once a comment (starting at a # which isn't
+// escaped with \) is cut off
+static size_t strip_comments(const char * line, size_t length){
+	for(size_t i = 0; i < length; i++){
+		if(line[i] == '#' && (i == 0 || line[i-1] != '\\')){
+			return i;
+		}
 	}
-	mystr->word[mystr->wordlength] = c;
-	mystr->wordlength++;
-	mystr->word[mystr->wordlength] = '\0';
+	return length;
 }
 
-
-// Function to get the targets in a line
-static unsigned int get_words(vararray * targets, const char * line, ssize_t length, char startchar, char endchar){
-	assert(targets);
-	if(line[0] == ':') return false;  // Should have a target. Something bad has happened
-	
-	const char * walker = line;
-	while(*walker != startchar){
-		walker++;
+// Checks if a line only has whitespace in it
+static bool is_blank(const char * line, size_t length){
+	for(size_t i = 0; i < length; i++){
+		if(!isspace((unsigned char)line[i])){
+			return false;
+		}
 	}
-	if(startchar == ':') walker++;  // get past colon if adding dependencies
+	return true;
+}
 
-	unsigned int num_targets = 0;
-	// Count how many targets there are
-	while(*walker != endchar){
-		if(is_valid_char(*walker) &&
-		   (*(walker + 1) == ' ' || *(walker + 1) == endchar || *(walker + 1) == '\t')){
-			num_targets++;
+// Function to add each space separated word of the text to list
+static void get_words(slice_list * list, const char * text, size_t length){
+	const char * walker = text;
+	const char * end = text + length;
+	while(walker != end){
+		// Skip empty spaces
+		while(walker != end && (*walker == ' ' || *walker == '\t')){
+			walker++;
+		}
+		if(walker == end){
+			break;
 		}
-		walker++;
-	}
 
-	if(startchar == ':' && num_targets == 0){
-		// There are no dependencies
-		return true;
+		// At a valid character, find the end of the word
+		const char * start = walker;
+		while(walker != end && *walker != ' ' && *walker != '\t'){
+			walker++;
+		}
+		add_slice(list, start, walker - start);
 	}
+}
 
-	walker = line;    // Reset the walker back to beginning
-	while(*walker != startchar){
-		walker++;
+// Makes sure the text buffer can hold size characters
+static void reserve_text(parser * p, size_t size){
+	if(p->textsize >= size){
+		return;
 	}
-	if(startchar == ':') walker++;
-	
-	// Create memory for the number of targets and add word
-	targets->words = calloc(num_targets, sizeof(varstring *));
-	for(int i = 0; i < num_targets; i++){
-		targets->words[i] = new_varstring();
+	while(p->textsize < size){
+		p->textsize = p->textsize ? p->textsize * 2 : INITREAD;
+	}
+	p->text = realloc(p->text, p->textsize);
+}
 
-		// Skip empty spaces
-		while(!is_valid_char(*walker)){
-			walker++;
+// Turns the slices in list into NUL-terminated strings, stored from
+// strings onward. Text is copied to p->text starting at *used, except for
+// names when there's an intern callback.
+static void list_to_strings(parser * p, const slice_list * list, bool names,
+							const char ** strings, size_t * used){
+	for(int i = 0; i < list->cursize; i++){
+		const mfp_slice_t * slice = &list->items[i];
+		if(names && p->cb->intern){
+			strings[i] = p->cb->intern(p->extradata, slice->str, slice->len);
+		} else {
+			memcpy(p->text + *used, slice->str, slice->len);
+			p->text[*used + slice->len] = '\0';
+			strings[i] = p->text + *used;
+			*used += slice->len + 1;
 		}
+	}
+}
 
-		// At a valid character, start adding
-		while(*walker != ' ' && *walker != endchar && *walker != '\t'){
-			append_char(targets->words[i], *walker);
-			walker++;
-		}
-	  
+// Makes sure p->strings can hold count pointers
+static void reserve_strings(parser * p, unsigned int count){
+	if(count > p->maxstrings){
+		p->maxstrings = count;
+		p->strings = realloc(p->strings, sizeof(char *) * count);
 	}
+}
 
-	targets->cursize = num_targets;
+// Returns the number of characters needed to copy list into p->text
+static size_t text_needed(const parser * p, const slice_list * list, bool names){
+	if(names && p->cb->intern){
+		return 0;
+	}
+	size_t needed = 0;
+	for(int i = 0; i < list->cursize; i++){
+		needed += list->items[i].len + 1;
+	}
+	return needed;
+}
 
-	return true;
+// Checks if the current rule is a .ONESHELL line
+static bool is_oneshell_rule(const parser * p){
+	const mfp_slice_t * t = p->targets.items;
+	return p->targets.cursize == 1 && t->len == strlen(ONESHELL_TARGET) &&
+		   memcmp(t->str, ONESHELL_TARGET, t->len) == 0;
 }
 
-// Function to get recipe
-static bool get_recipe(vararray * recipe_array, const char * recipe, ssize_t length){
-	if(recipe[0] != '\t'){
-		// Something bad has happened
-		return false;
+// Hands the targets listed on a .ONESHELL line to its callback
+static bool process_oneshell(parser * p){
+	reserve_strings(p, p->dependencies.cursize);
+	reserve_text(p, text_needed(p, &p->dependencies, true));
+	size_t used = 0;
+	list_to_strings(p, &p->dependencies, true, p->strings, &used);
+	return p->cb->oneshell_cb(p->extradata, p->strings, p->dependencies.cursize);
+}
+
+// Hands the current rule to the callbacks. Slices are passed as they are
+// if there's a slice callback; otherwise they are turned into strings in
+// buffers that are reused for every rule.
+static bool process_rule(parser * p){
+	const mfp_cb_t * cb = p->cb;
+	if(cb->oneshell_cb && is_oneshell_rule(p)){
+		return process_oneshell(p);
+	}
+	if(cb->rule_slice_cb){
+		return cb->rule_slice_cb(p->extradata,
+								 p->targets.items, p->targets.cursize,
+								 p->dependencies.items, p->dependencies.cursize,
+								 p->recipies.items, p->recipies.cursize);
+	}
+	if(!cb->rule_cb){
+		return true;
 	}
 
-	// Make size for recipe
-	recipe_array->words = realloc(recipe_array->words, sizeof(varstring *) * \
-								  (recipe_array->cursize + 1));
-	recipe_array->words[recipe_array->cursize] = new_varstring();
+	reserve_strings(p, p->targets.cursize + p->dependencies.cursize + p->recipies.cursize);
+
+	// Work out how much text needs copying first, so the strings don't
+	// move while they are filled in
+	reserve_text(p, text_needed(p, &p->targets, true) +
+				 text_needed(p, &p->dependencies, true) +
+				 text_needed(p, &p->recipies, false));
+
+	size_t used = 0;
+	const char ** t_list = p->strings;
+	const char ** d_list = t_list + p->targets.cursize;
+	const char ** r_list = d_list + p->dependencies.cursize;
+	list_to_strings(p, &p->targets, true, t_list, &used);
+	list_to_strings(p, &p->dependencies, true, d_list, &used);
+	list_to_strings(p, &p->recipies, false, r_list, &used);
+
+	return cb->rule_cb(p->extradata, t_list, p->targets.cursize,
+					   d_list, p->dependencies.cursize,
+					   r_list, p->recipies.cursize);
+}
 
-	const char * walker = &(recipe[1]);    // Skip the \t character
-	while(*walker != '\n'){
-		append_char(recipe_array->words[recipe_array->cursize], *walker);
-		walker++;
+// Function to handle a line starting a new rule
+static bool parse_rule_line(parser * p, const char * line, size_t length){
+	FILE * error = p->cb->error;
+	const char * colon = memchr(line, ':', length);
+	if(!colon){
+		// something wrong happened
+		fprintf(error, "Error: Line not target/dependency or rule\n");
+		return false;
+	}
+	if(!is_valid_target_line(line, length)){
+		// Invlaid character
+		fprintf(error, "Error: Invalid char in target or dependency.\n");
+		return false;
 	}
-	
-	recipe_array->cursize += 1;
 
+	// This line ends the previous rule
+	if(p->inrule && !process_rule(p)){
+		fprintf(error, "Error: Unable to process rule\n");
+		return false;
+	}
+	p->targets.cursize = 0;
+	p->dependencies.cursize = 0;
+	p->recipies.cursize = 0;
+	p->inrule = true;
+
+	// Read the targets and dependencies
+	get_words(&p->targets, line, colon - line);
+	get_words(&p->dependencies, colon + 1, length - (colon + 1 - line));
+	if(p->targets.cursize == 0){
+		// Should have a target
+		fprintf(error, "Error: Unable to get targets/dependencies\n");
+		return false;
+	}
 	return true;
-	
 }
 
-static const char ** vararray_to_list(vararray * array){
-	const char ** list = calloc(array->cursize, sizeof(char *));
-	for(int i = 0; i < array->cursize; i++){
-		list[i] = array->words[i]->word;
+#ifdef MFP_SUPPORT_VARIABLES
+// Returns the length of the identifier starting the line if the line is a
+// variable definition (IDENTIFIER=VALUE), 0 if it isn't
+static size_t variable_name_length(const char * line, size_t length){
+	if(length == 0 || (!isalpha((unsigned char)line[0]) && line[0] != '_')){
+		return 0;
 	}
-
-	return list;
+	size_t i = 1;
+	while(i < length && (isalnum((unsigned char)line[i]) || line[i] == '_')){
+		i++;
+	}
+	return i < length && line[i] == '=' ? i : 0;
 }
 
-static bool process_rule(vararray * t, vararray * d, vararray * r,
-						 const mfp_cb_t * cb, void * extradata){
+// Function to handle a variable definition whose name is namelen long
+static bool parse_variable_line(parser * p, const char * line, size_t length,
+								size_t namelen){
+	// This line ends the previous rule
+	if(p->inrule && !process_rule(p)){
+		fprintf(p->cb->error, "Error: Unable to process rule\n");
+		return false;
+	}
+	p->inrule = false;
+	if(!p->cb->variable_cb){
+		return true;
+	}
 
-	const char ** t_list;
-	const char ** d_list;
-	const char ** r_list;
+	// Name and value, each NUL-terminated, the = replaced by the first NUL
+	reserve_text(p, length + 1);
+	memcpy(p->text, line, length);
+	p->text[namelen] = '\0';
+	p->text[length] = '\0';
+	return p->cb->variable_cb(p->extradata, p->line, p->text, p->text + namelen + 1);
+}
+#endif
+
+// Function to handle one line, without its newline
+static bool parse_line(parser * p, const char * line, size_t length){
+	// Strip beginning whitespace
+	while(length > 0 && *line == ' '){
+		line++;
+		length--;
+	}
+	length = strip_comments(line, length);
 
-	t_list = vararray_to_list(t);
-	d_list = vararray_to_list(d);
-	r_list = vararray_to_list(r);
+	// Nothing left, just continue
+	if(length == 0){
+		return true;
+	}
 
-				
-	if(cb){
-		if(!cb->rule_cb(extradata, t_list, t->cursize,			\
-						d_list, d->cursize,					\
-						r_list, r->cursize)){
-			return false;
+	// Check to see if it's a target line or rule line
+	if(line[0] != '\t'){
+#ifdef MFP_SUPPORT_VARIABLES
+		size_t namelen = variable_name_length(line, length);
+		if(namelen > 0){
+			return parse_variable_line(p, line, length, namelen);
 		}
+#endif
+		return parse_rule_line(p, line, length);
 	}
-														 
-	free_list(t);
-	free_list(d);
-	free_list(r);
-	
-	free(t_list);
-	free(d_list);
-	free(r_list);
 
+	// In the recipe. Blank lines don't end it and are skipped.
+	if(is_blank(line, length)){
+		return true;
+	}
+	if(!p->inrule){
+		fprintf(p->cb->error, "Error: Unable to get recipe\n");
+		return false;
+	}
+	add_slice(&p->recipies, line + 1, length - 1);    // Skip the \t character
 	return true;
 }
 
-
-bool mfp_parse(FILE * f, const mfp_cb_t * cb, void * extradata){
-	char * line = NULL;     // Will point to each line in the makefile
-	size_t len = 0;         // Specifying to getline() to go to end of the line
-	ssize_t read;           // Getting how many bytes were read
-	bool target = false; // See if we are actively in a target or not
-	bool first = true;      // See if we are at the first target or not
+bool mfp_parse_buffer(const char * buf, size_t len, const mfp_cb_t * cb,
+					  void * extradata){
+	assert(cb);
+	parser p;
+	memset(&p, 0, sizeof(parser));
+	p.cb = cb;
+	p.extradata = extradata;
 
 	bool exit_status = true;
-
-	vararray * targets = NULL;
-	vararray * dependencies = NULL;
-	vararray * recipies = NULL;
-	
-	while((read = getline(&line, &len, f)) != -1){
-		read = strip_whitespace_beg(&line, read);
-		read = strip_comments(&line, read);
-
-        // If the first character is a newline just continue
-		if(line[0] == '\n'){
-			continue;
+	const char * end = buf + len;
+	const char * line = buf;
+	while(line < end){
+		p.line++;
+		const char * newline = memchr(line, '\n', end - line);
+		if(!newline){
+			// Last line doesn't have to end in a newline
+			newline = end;
 		}
-
-		// Check if there's a comment
-		if(line[0] == '#'){
-			continue;
+		if(!parse_line(&p, line, newline - line)){
+			exit_status = false;
+			break;
 		}
+		line = newline + 1;
+	}
 
-		// Check to see if it's a target line or rule line
-		if(line[0] != '\t'){
-			for(int i = 0; i < read; i++){
-				if(line[i] == ':'){
-					if(!is_valid_target_line(line, read)){
-						// Invlaid character
-						printf("Error: Invalid char in target or dependency.\n");
-						exit_status = false;
-						goto end;
-					}
-					target = true;
-				}
-			}
-			if(!target){
-				// something wrong happened
-				printf("Error: Line not target/dependency or rule\n");
-				exit_status = false;
-				goto end;
-			}
-		} else if (line[0] == '\t' && line[1] == '\n'){
-			// No rule and can skip
-			continue;\
+	if(exit_status && p.inrule){
+		if(!process_rule(&p)){
+			fprintf(cb->error, "Error: Unable to process last rule\n");
+			exit_status = false;
 		}
+	}
 
-		if(target){		 
-			if(first){
-				// first target encountered -> no need to send previous stuff to function
-				targets = new_vararray();
-				dependencies = new_vararray();
-				recipies = new_vararray();
-				
-				first = false;
-
-			} else {
-				if(!process_rule(targets, dependencies, recipies, cb, extradata)){
-					printf("Error: Unable to process rule\n");
-					exit_status = false;
-					goto end;
-				}
-
-			}
-
-			// Read the targets and dependencies
-			if(!get_words(targets, line, read, line[0], ':') ||
-			   !get_words(dependencies, line, read, ':', line[read-1])){
-				// Error occured with invalid character in targets
-				printf("Error: Unable to get targets/dependencies\n");
-				exit_status = false;
-				goto end;
-			}
+	free(p.targets.items);
+	free(p.dependencies.items);
+	free(p.recipies.items);
+	free(p.strings);
+	free(p.text);
+	return exit_status;
+}
 
-		} else {
-			// In the rule
-			if(!get_recipe(recipies, line, read)){
-				// Something bad happened
-				printf("Error: Unable to get recipe\n");
-				exit_status = false;
-				goto end;
-			}
-			
+bool mfp_parse(FILE * f, const mfp_cb_t * cb, void * extradata){
+	// Read the whole stream, then parse it from memory
+	size_t size = INITREAD;
+	size_t len = 0;
+	char * buf = malloc(size);
+	size_t read;
+	while((read = fread(buf + len, 1, size - len, f)) > 0){
+		len += read;
+		if(len == size){
+			size *= 2;
+			buf = realloc(buf, size);
 		}
-		if(target) target = false;
-
 	}
-
-	if(targets->cursize > 0){
-		if(!process_rule(targets, dependencies, recipies, cb, extradata)){
-			printf("Error: Unable to process last rule\n");
-			exit_status = false;
-		}
+	if(ferror(f)){
+		fprintf(cb->error, "Error reading makefile.\n");
+		free(buf);
+		return false;
 	}
-	
-end:
-	if(targets)free_list(targets);
-	if(dependencies)free_list(dependencies);
-	if(recipies)free_list(recipies);
-	if(line) free(line);
-	if(targets) free_vararray(targets);
-	if(dependencies) free_vararray(dependencies);
-	if(recipies) free_vararray(recipies);
+
+	bool exit_status = mfp_parse_buffer(buf, len, cb, extradata);
+	free(buf);
 	return exit_status;
 }
 
+bool mfp_parse_path(const char * path, const mfp_cb_t * cb, void * extradata){
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		fprintf(cb->error, "Error opening file.\n");
+		return false;
+	}
+
+	struct stat statinfo;
+	if(fstat(fd, &statinfo) < 0 || !S_ISREG(statinfo.st_mode) || statinfo.st_size == 0){
+		// Not something we can map (or nothing to map), read it instead
+		FILE * f = fdopen(fd, "r");
+		if(!f){
+			close(fd);
+			fprintf(cb->error, "Error opening file.\n");
+			return false;
+		}
+		bool exit_status = mfp_parse(f, cb, extradata);
+		fclose(f);
+		return exit_status;
+	}
 
+	size_t len = statinfo.st_size;
+	void * map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		fprintf(cb->error, "Error mapping file.\n");
+		return false;
+	}
+	posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
 
+	bool exit_status = mfp_parse_buffer(map, len, cb, extradata);
+	munmap(map, len);
+	return exit_status;
+}
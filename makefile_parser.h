@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
 // This file needs to #define MFP_SUPPORT_VARIABLES if the parser
@@ -38,6 +39,7 @@
  *   cannot contain '='.
  *   The valid characters for target and dependency are:
  *      [a-z,A-Z,0-9,_,.,-] as well as / (directory separator)
+ *   and % (for pattern rules, see below)
  *
  *   !!Any other character in a target or dependency should result in an error!!
  *
@@ -72,6 +74,22 @@
  *
  *  a b c: dep1 dep2
  *
+ *  ==== Pattern rules ====
+ *
+ *  %.o: %.c common.h
+ *
+ *  A target containing % is a pattern rule. It is passed to the rule
+ *  callback like any other rule; the parser gives % no special meaning.
+ *
+ *  ==== Special targets ====
+ *
+ *  .ONESHELL: [target...]
+ *
+ *  If a oneshell callback is set, a rule whose only target is .ONESHELL is
+ *  passed to it instead of the rule callback. Its dependencies name the
+ *  targets whose recipe lines should all run in a single shell; with no
+ *  dependencies, every recipe should. Recipe lines after it are ignored.
+ *
  *  !! THERE SHOULD BE NO ARTIFICIAL LIMITATIONS ON THE NUMBER OF           !!
  *  !! TARGETS/RULES/RECIPE LENGTH/LENGTH OF VARIABLE NAMES                 !!
  *  !! LENGTH OF A LINE/...                                                 !!
@@ -114,12 +132,53 @@ typedef bool (*mfp_rule_cb_t) (void * userdata,
         const char ** dependencies, unsigned int dcount,
         const char ** recipe, unsigned int rcount);
 
+/// A piece of the parsed text: len characters starting at str, not
+/// NUL-terminated.
+struct mfp_slice_t
+{
+    const char * str;
+    size_t len;
+};
+
+typedef struct mfp_slice_t mfp_slice_t;
+
+/// Same as mfp_rule_cb_t, but every target, dependency and recipe line is
+/// passed as a slice pointing straight into the text being parsed, so
+/// nothing is copied. The slices remain valid as long as that text does
+/// (for mfp_parse and mfp_parse_path: until they return).
+typedef bool (*mfp_rule_slice_cb_t) (void * userdata,
+        const mfp_slice_t * target, unsigned int tcount,
+        const mfp_slice_t * dependencies, unsigned int dcount,
+        const mfp_slice_t * recipe, unsigned int rcount);
+
+/// Pointer to a function which stores a copy of the len characters at str
+/// (not NUL-terminated) and returns it as a NUL-terminated string that stays
+/// valid after parsing, returning the same pointer every time it is passed
+/// the same characters.
+///
+/// If set, every target and dependency name is passed through it and the
+/// rule callback receives the returned pointers, so the parser doesn't need
+/// a copy of its own for each name it reads.
+typedef const char * (*mfp_intern_cb_t) (void * userdata,
+        const char * str, size_t len);
+
+/// Pointer to a function called for every .ONESHELL rule (see above).
+/// targets (tcount of them, possibly none) remain valid for the duration of
+/// the call only, unless they came from the intern callback.
+///
+///   If the callback returns false, parsing will stop.
+typedef bool (*mfp_oneshell_cb_t) (void * userdata,
+        const char ** targets, unsigned int tcount);
+
 struct mfp_cb_t
 {
 #ifdef MFP_SUPPORT_VARIABLES
     mfp_variable_cb_t  variable_cb;
 #endif
     mfp_rule_cb_t rule_cb;
+    mfp_rule_slice_cb_t rule_slice_cb;  // Optional; used instead of rule_cb
+    mfp_intern_cb_t intern;     // Optional, can be NULL
+    mfp_oneshell_cb_t oneshell_cb;  // Optional, can be NULL
     FILE * error;
 };
 
@@ -133,3 +192,11 @@ typedef struct mfp_cb_t mfp_cb_t;
 /// This function should NOT fclose cb->error
 bool mfp_parse(FILE * f, const mfp_cb_t * cb, void * extradata);
 
+/// Same as mfp_parse, but parses the len characters at buf.
+bool mfp_parse_buffer(const char * buf, size_t len, const mfp_cb_t * cb,
+        void * extradata);
+
+/// Same as mfp_parse, but parses the named file. The file is memory mapped
+/// (when possible) and parsed in place: with rule_slice_cb or intern set,
+/// no text is copied while parsing.
+bool mfp_parse_path(const char * path, const mfp_cb_t * cb, void * extradata);
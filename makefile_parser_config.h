@@ -1 +1,2 @@
 #define MFP_SUPPORT_MULTITARGET
+#define MFP_SUPPORT_VARIABLES
@@ -69,11 +69,21 @@ bool print(void * data, const char ** target, unsigned int tcount,
 	return true;
 }
 
+bool print_variable(void * data, unsigned int line, const char * varname,
+					const char * value){
+	printf("%s=%s\n", varname, value);
+	return true;
+}
+
 
 int main(int argc, char ** args){
 	mfp_cb_t cb;
 	cb.error = stderr;
 	cb.rule_cb = print;
+	cb.variable_cb = print_variable;
+	cb.rule_slice_cb = NULL;
+	cb.intern = NULL;
+	cb.oneshell_cb = NULL;
 	if(argc != 2){
 		printf("Error: Must have a command line argument.\n");
 		return EXIT_FAILURE;
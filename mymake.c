@@ -1,100 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
 #include "mymake.h"
-#include "digraph.h"
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
 #include <assert.h>
 #include "util.h"
+#include "arena.h"
+#include "strtab.h"
+#include "mymake_internal.h"
+#include "statedb.h"
 
 #define CSIZE 1
+// Targets, names and recipes are allocated from an arena in blocks of this
+// many bytes
+#define TARGET_BLOCKSIZE (256 * 1024)
+// Initial size of the job list, will allocate more if necessary
+#define INITJOBS 16
+// Initial size of the list of changed files, will allocate more if needed
+#define INITTOUCHED 16
+// Number of recipes listed as the slowest when tracing
+#define SLOWEST_COUNT 10
+// How often the load and memory are checked again while recipes are held
+// back, and how often finished recipes are looked for meanwhile, in
+// milliseconds
+#define THROTTLE_CHECK_MS 250
+#define THROTTLE_POLL_MS 10
 
-// Structure which will be hold in digraph_node_t as nodedata
-typedef struct target{
-	char * name;
-	char ** recipies;
-	unsigned int rcount;
-} target;
+// States of a target while cycles are removed
+#define VISIT_ACTIVE 1    // The links from it are still being followed
+#define VISIT_DONE 2      // Every target it leads to has been seen
 
+// A target whose recipe needs to run during mymake_build
+typedef struct job{
+	target * data;
+	digraph_node_t * node;
+	unsigned int order;      // Position in the serial build order
+	unsigned int pending;    // Number of unfinished jobs this one depends on
+	struct job ** waiters;   // Jobs that depend on this one
+	unsigned int wcount;
+	unsigned int line;       // Recipe line currently running
+	pid_t pid;               // 0 when no command is running
+	uint64_t signature;      // Input signature, if record_signature is set
+	bool record_signature;   // Store signature in m->db once finished
+	unsigned int slot;       // Job slot while running, shown as the trace row
+	uint64_t ready_at;       // When it became ready (tracing only)
+	uint64_t line_start;     // When the current line started (tracing only)
+	uint64_t queue_us;       // Time spent ready but waiting for a slot
+	uint64_t run_us;         // Time spent running recipe lines
+	uint64_t priority;       // Estimated time from its start to the goal's end
+} job;
 
-static target * new_target(const char * name, const char ** recipies, const unsigned int rcount){
-	assert(name);
-
-	target * t = calloc(CSIZE, sizeof(target));
-
-	// Add the target name
-	int length = strlen(name) + 1;
-	t->name = calloc(length, sizeof(char));
-	strncpy(t->name, name, length);
-	//for(int i = 0; i < namelength; i++){
-	//	t->name[i] = name[i];
-	//}
+// All jobs of one mymake_build call
+typedef struct job_plan{
+	job ** jobs;
+	unsigned int cursize;
+	unsigned int maxsize;
+	job ** waiters;          // Storage for the waiters of every job
+} job_plan;
 
-	// Add the recipies
-	if(recipies){
-		t->recipies = calloc(rcount, sizeof(char *));
-		const char * currecipe = NULL;
-		for(int i = 0; i < rcount; i++){
-			currecipe = recipies[i];
+// Jobs whose dependencies have all finished
+typedef struct job_heap{
+	job ** jobs;
+	unsigned int cursize;
+} job_heap;
 
-			length = strlen(currecipe) + 1;
-			t->recipies[i] = calloc(length, sizeof(char));
-			strncpy(t->recipies[i], currecipe, length);
 
-		}
-	} else {
+// Copies the recipe lines into t. Everything is allocated from arena.
+static void set_recipe(arena_t * arena, target * t, const char ** recipies,
+					   const unsigned int rcount){
+	t->rcount = rcount;
+	if(rcount == 0){
 		t->recipies = NULL;
+		return;
+	}
+	t->recipies = arena_alloc(arena, rcount * sizeof(char *));
+	for(int i = 0; i < rcount; i++){
+		t->recipies[i] = arena_strdup(arena, recipies[i]);
 	}
+}
 
-	t->rcount = rcount;
+// name must be interned, it isn't copied
+static target * new_target(arena_t * arena, const char * name,
+						   const char ** recipies, const unsigned int rcount){
+	assert(name);
+
+	// Memory from the arena is already zeroed
+	target * t = arena_alloc(arena, sizeof(target));
+	t->name = name;
+	set_recipe(arena, t, recipies, rcount);
 	return t;
 }
 
-static void free_target(void * t){
-	assert(t);
-	target * myt = (target *)t;
-	free(myt->name);
-	for(int i = 0; i < myt->rcount; i++){
-		free(myt->recipies[i]);
+#define INITNAMES 64
+
+// Returns the id of name, interning it if necessary
+unsigned int mymake_name_id(mymake_t * m, const char * name, size_t len){
+	unsigned int id = strtab_intern(m->names, name, len);
+	if(id >= m->bynamesize){
+		unsigned int oldsize = m->bynamesize;
+		while(id >= m->bynamesize){
+			m->bynamesize *= 2;
+		}
+		m->byname = realloc(m->byname, m->bynamesize * sizeof(digraph_node_t *));
+		memset(m->byname + oldsize, 0,
+			   (m->bynamesize - oldsize) * sizeof(digraph_node_t *));
 	}
-	free(myt->recipies);
-	free(myt);
+	return id;
 }
 
-// Function used by cb in digraph_find function to see if a node is in the graph
-bool findnode(digraph_t * d, digraph_node_t * node, void * userdata){
-	char * thisname = (char *) userdata;
-	target * t = (target *) digraph_node_get_data(d, node);
-	if(strncmp(t->name, thisname, strlen(thisname)) == 0){
-		return true;
+// Find the node for the target with exactly this name, NULL if there is none
+static digraph_node_t * find_target(mymake_t * m, const char * name){
+	unsigned int id = strtab_find(m->names, name, strlen(name));
+	if(id == STRTAB_NONE || id >= m->bynamesize){
+		return NULL;
 	}
-	return false;
+	return m->byname[id];
 }
 
-struct mymake_t{
-	FILE * output;
-	FILE * error;
-	digraph_t * graph;
-	digraph_node_t * firstnode;
-};
+// Create a node for the target with the given name id. The name must not
+// already have a node.
+digraph_node_t * mymake_new_node(mymake_t * m, unsigned int name_id,
+								 const char ** recipe, unsigned int recipecount){
+	assert(!m->byname[name_id]);
+	target * t = new_target(m->arena, strtab_get(m->names, name_id), recipe, recipecount);
+	t->name_id = name_id;
+	m->byname[name_id] = digraph_node_create(m->graph, (void *)t);
+	return m->byname[name_id];
+}
 
 mymake_t * mymake_create(FILE * output, FILE * error){
 	mymake_t * make = calloc(CSIZE, sizeof(mymake_t));
 	make->output = output;
 	make->error = error;
-	make->graph = digraph_create(free_target);
+	make->graph = digraph_create(NULL);
+	make->arena = arena_create(TARGET_BLOCKSIZE);
 	make->firstnode = NULL;
+	make->names = strtab_create();
+	make->varnames = strtab_create();
+	make->suffixes = strtab_create();
+	make->bynamesize = INITNAMES;
+	make->byname = calloc(make->bynamesize, sizeof(digraph_node_t *));
+	make->jobs = 1;
+	make->epoch = 0;
 
 	return make;
 }
 
-bool mymake_supports_variables(){
-	return false;
-}
-
-bool mymake_add_variable(mymake_t * m, const char * varname, const char * val){
-	fprintf(m->error, "Error: This make does not support variables\n");
-	return false;
+const char * mymake_intern(mymake_t * m, const char * str, size_t len){
+	return strtab_get(m->names, mymake_name_id(m, str, len));
 }
 
 bool mymake_add_target(mymake_t * m, const char * name, const char ** deps,
@@ -102,124 +162,295 @@ bool mymake_add_target(mymake_t * m, const char * name, const char ** deps,
 	assert(m);
 	assert(name);
 
-	// Check to see if target is in the graph already
-	digraph_node_t * search_node = digraph_find(m->graph, findnode, (void *)name);
-	if(search_node){
-		// Check to see if there's a recipe
-		target * oldt = (target *)digraph_node_get_data(m->graph, search_node);
-		if(oldt->rcount != 0 || oldt->recipies != NULL){
-			// Can't have two recipies
-			fprintf(m->error, "Error: Multiple recipies for %s detected.\n", name);
-			return false;
-		}
+	if(strchr(name, '%')){
+		return mymake_add_pattern(m, name, deps, depcount, recipe, recipecount, true);
 	}
 
-	// Target node
-	target * t = new_target(name, recipe, recipecount);
-	digraph_node_t * target_node = NULL;
-	target * junk_node = NULL;
-
-
-	if(!search_node){
-		// It's not in the graph so add it
-		target_node = digraph_node_create(m->graph, (void *)t);
-		if(!(m->firstnode)){
-			// This is the first node added
-			m->firstnode = target_node;
+	// Check to see if target is in the graph already
+	unsigned int name_id = mymake_name_id(m, name, strlen(name));
+	digraph_node_t * target_node = m->byname[name_id];
+	if(target_node){
+		// Only one of the rules for a target may have a recipe
+		target * oldt = (target *)digraph_node_get_data(m->graph, target_node);
+		if(recipecount > 0){
+			if(oldt->rcount != 0){
+				// Can't have two recipies
+				fprintf(m->error, "Error: Multiple recipies for %s detected.\n", name);
+				return false;
+			}
+			set_recipe(m->arena, oldt, recipe, recipecount);
 		}
 	} else {
-		// In the graph and just need to change the data it points too
-		junk_node = digraph_node_set_data(m->graph, search_node, t);
-		free_target(junk_node);
-		target_node = digraph_find(m->graph, findnode, (void *)name);
+		// It's not in the graph so add it
+		target_node = mymake_new_node(m, name_id, recipe, recipecount);
+	}
+	if(!(m->firstnode)){
+		// This is the first target added (a .ONESHELL line may have
+		// created its node already)
+		m->firstnode = target_node;
 	}
 
 	// Add its dependencies
-	target * d = NULL;
+	digraph_node_t * search_node = NULL;
 	for(int i = 0; i < depcount; i++){
 		// If it's not in the graph add it
-		search_node = digraph_find(m->graph, findnode, (void *)deps[i]);
+		unsigned int dep_id = mymake_name_id(m, deps[i], strlen(deps[i]));
+		search_node = m->byname[dep_id];
 		if(!search_node){
-			d = new_target(deps[i], NULL, 0);
-			search_node = digraph_node_create(m->graph, (void *)d);
+			search_node = mymake_new_node(m, dep_id, NULL, 0);
 		}
 
 		// Add the link
+		if(search_node == target_node){
+			fprintf(m->error, "Error: Circular dependency of %s on itself dropped.\n", name);
+			continue;
+		}
 		digraph_add_link(m->graph, target_node, search_node);
+		m->acyclic = false;
 	}
 	return true;
 }
 
-typedef struct node_array{
-	digraph_node_t ** nodes;
-	unsigned int cursize;
-	unsigned int maxsize;
-} node_array;
+void mymake_add_oneshell(mymake_t * m, const char ** targets, unsigned int count){
+	assert(m);
+	if(count == 0){
+		m->oneshell_all = true;
+		return;
+	}
+	for(int i = 0; i < count; i++){
+		unsigned int name_id = mymake_name_id(m, targets[i], strlen(targets[i]));
+		digraph_node_t * node = m->byname[name_id];
+		if(!node){
+			node = mymake_new_node(m, name_id, NULL, 0);
+		}
+		((target *)digraph_node_get_data(m->graph, node))->oneshell = true;
+	}
+}
+
+// A target whose links remove_cycles is following
+typedef struct cycle_frame{
+	digraph_node_t * node;
+	unsigned int link;       // Next link to follow
+} cycle_frame;
+
+// Drops the links of component c that lead back to a target a depth first
+// search from its first member is still inside of, which leaves it without
+// cycles. state (by node id) must be 0 for every member.
+static void break_component(mymake_t * m, const unsigned int * component,
+							unsigned int c, const unsigned int * members,
+							unsigned int count, unsigned char * state){
+	cycle_frame * frames = malloc(count * sizeof(cycle_frame));
+	unsigned int nframes = 0;
+	frames[nframes].node = digraph_node_from_id(m->graph, members[0]);
+	frames[nframes].link = 0;
+	nframes++;
+	state[members[0]] = VISIT_ACTIVE;
 
-static node_array * new_node_array(unsigned int size){
-	node_array * node = calloc(CSIZE, sizeof(node_array));
-	node->nodes = calloc(size, sizeof(digraph_node_t *));
-	node->cursize = 0;
-	node->maxsize = size;
-	return node;
+	while(nframes > 0){
+		cycle_frame * f = &frames[nframes - 1];
+		digraph_node_t * next = NULL;
+		if(!digraph_node_get_link(m->graph, f->node, f->link, &next)){
+			state[digraph_node_id(m->graph, f->node)] = VISIT_DONE;
+			nframes--;
+			continue;
+		}
+		unsigned int id = digraph_node_id(m->graph, next);
+		if(component[id] != c || state[id] == VISIT_DONE){
+			f->link++;
+		} else if(state[id] == VISIT_ACTIVE){
+			target * from = (target *)digraph_node_get_data(m->graph, f->node);
+			target * to = (target *)digraph_node_get_data(m->graph, next);
+			fprintf(m->error, "Error: Dependency of %s on %s dropped.\n", from->name, to->name);
+			// The links after it move down into its place
+			digraph_remove_link(m->graph, f->node, next);
+		} else {
+			f->link++;
+			state[id] = VISIT_ACTIVE;
+			frames[nframes].node = next;
+			frames[nframes].link = 0;
+			nframes++;
+		}
+	}
+	free(frames);
 }
 
-static void free_node_array(node_array * node){
-	free(node->nodes);
-	free(node);
+// Reports every cycle in the graph with the targets in it, and drops links
+// until there are none left, so that planning can take it for granted that
+// a target is reached only after everything it depends on has been decided.
+// Runs in time linear in the size of the graph; nothing more is done unless
+// there is a cycle.
+static void remove_cycles(mymake_t * m){
+	m->acyclic = true;
+	unsigned int count = digraph_node_id_limit(m->graph);
+	unsigned int * component = malloc((count + 1) * sizeof(unsigned int));
+	unsigned int ncomponents = digraph_components(m->graph, component);
+	if(ncomponents == digraph_node_count(m->graph)){
+		// Every target is a component of its own
+		free(component);
+		return;
+	}
+
+	// Group the targets by component, in the order they were defined:
+	// component c is members[first[c]] up to members[first[c + 1]]
+	unsigned int * first = calloc(ncomponents + 1, sizeof(unsigned int));
+	unsigned int * fill = malloc((ncomponents + 1) * sizeof(unsigned int));
+	unsigned int * members = malloc(count * sizeof(unsigned int));
+	for(unsigned int i = 0; i < count; i++){
+		if(component[i] != UINT_MAX){
+			first[component[i] + 1]++;
+		}
+	}
+	for(unsigned int c = 0; c < ncomponents; c++){
+		first[c + 1] += first[c];
+	}
+	memcpy(fill, first, (ncomponents + 1) * sizeof(unsigned int));
+	for(unsigned int i = 0; i < count; i++){
+		if(component[i] != UINT_MAX){
+			members[fill[component[i]]++] = i;
+		}
+	}
+
+	unsigned char * state = calloc(count + 1, sizeof(unsigned char));
+	for(unsigned int i = 0; i < count; i++){
+		unsigned int c = component[i];
+		if(c == UINT_MAX){
+			// A destroyed node
+			continue;
+		}
+		unsigned int size = first[c + 1] - first[c];
+		if(size < 2 || members[first[c]] != i){
+			// No cycle, or one that was dealt with at its first member
+			continue;
+		}
+		fprintf(m->error, "Error: Circular dependency between");
+		for(unsigned int k = 0; k < size; k++){
+			target * t = (target *)digraph_node_get_data(m->graph,
+					digraph_node_from_id(m->graph, members[first[c] + k]));
+			fprintf(m->error, "%s %s", k == 0 ? "" : (k + 1 == size ? " and" : ","), t->name);
+		}
+		fprintf(m->error, ".\n");
+		break_component(m, component, c, members + first[c], size, state);
+	}
+	free(state);
+	free(members);
+	free(fill);
+	free(first);
+	free(component);
 }
 
-static void resize_node(node_array * node){
-	node->nodes = realloc(node->nodes, sizeof(digraph_node_t *) * (node->maxsize * 2));
-	node->maxsize = node->maxsize * 2;
+// Remembers that the file of node changed, for incremental builds. Once
+// there are as many changes as nodes, checking everything is about as
+// quick, so the list starts over.
+static void note_touched(mymake_t * m, digraph_node_t * node){
+	if(!m->incremental){
+		return;
+	}
+	if(m->touched_count >= digraph_node_count(m->graph) + INITTOUCHED){
+		m->touched_count = 0;
+		m->touched_floor = m->epoch + 1;
+	}
+	if(m->touched_count == m->touched_size){
+		m->touched_size = m->touched_size ? m->touched_size * 2 : INITTOUCHED;
+		m->touched = realloc(m->touched, m->touched_size * sizeof(digraph_node_t *));
+		m->touched_epochs = realloc(m->touched_epochs, m->touched_size * sizeof(unsigned int));
+	}
+	m->touched[m->touched_count] = node;
+	m->touched_epochs[m->touched_count] = m->epoch;
+	m->touched_count++;
 }
 
-static bool visited(node_array * node, digraph_node_t * checknode){
-	unsigned int size = node->cursize;
-	for(int i = 0; i < size; i++){
-		if(node->nodes[i] == checknode){
-			return true;
+// Marks every target that depends, directly or not, on a file that changed
+// since goal was last brought up to date, by following incoming links from
+// those files. Returns false if that isn't known, and the whole graph
+// below goal has to be checked.
+static bool mark_dirty(mymake_t * m, target * goal, bool verbose){
+	if(goal->checked_epoch == 0 || goal->checked_epoch < m->touched_floor){
+		return false;
+	}
+	unsigned int changes = 0;
+	digraph_node_t ** stack = malloc(digraph_node_count(m->graph) * sizeof(digraph_node_t *));
+	unsigned int depth = 0;
+	for(unsigned int i = 0; i < m->touched_count; i++){
+		target * t = (target *)digraph_node_get_data(m->graph, m->touched[i]);
+		if(m->touched_epochs[i] >= goal->checked_epoch && t->dirty_epoch != m->epoch){
+			t->dirty_epoch = m->epoch;
+			stack[depth++] = m->touched[i];
+			changes++;
 		}
 	}
-	return false;
+	while(depth > 0){
+		digraph_node_t * node = stack[--depth];
+		unsigned int count = digraph_node_incoming_link_count(m->graph, node);
+		digraph_node_t * parent = NULL;
+		for(unsigned int i = 0; i < count; i++){
+			digraph_node_get_incoming_link(m->graph, node, i, &parent);
+			target * t = (target *)digraph_node_get_data(m->graph, parent);
+			if(t->dirty_epoch != m->epoch){
+				t->dirty_epoch = m->epoch;
+				stack[depth++] = parent;
+			}
+		}
+	}
+	free(stack);
+	if(verbose) fprintf(m->output, "Checking what depends on %u changed files.\n", changes);
+	return true;
 }
 
-static void add_node(node_array * node, digraph_node_t * newnode){
-	if(node->cursize == node->maxsize){
-		resize_node(node);
+uint64_t mymake_target_mtime(mymake_t * m, target * t){
+	if(t->mtime_epoch == m->epoch || (m->keep_mtimes && t->mtime_epoch != 0)){
+		m->stat_saved++;
+		return t->mtime;
 	}
-	node->nodes[node->cursize] = newnode;
-	node->cursize++;
+	t->mtime = last_modification(t->name);
+	t->mtime_epoch = m->epoch;
+	m->stat_calls++;
+	return t->mtime;
 }
 
 // Does the check to see if timestamps need to be built
-static bool check_timestamp(const char * depname, const char * curname){
-	assert(depname);
-	assert(curname);
-	if(last_modification(depname) == 0 ||
-	   last_modification(depname) > last_modification(curname)){
+static bool check_timestamp(mymake_t * m, target * dep, target * cur){
+	assert(dep);
+	assert(cur);
+	uint64_t depmtime = mymake_target_mtime(m, dep);
+	if(depmtime == 0 || depmtime > mymake_target_mtime(m, cur)){
 		return true;
 	}
 	return false;
 }
 
-static bool build(mymake_t * m, digraph_node_t * node, bool verbose,
-				  bool dryrun, bool isfirst, node_array * visited_nodes){
-
-	// Check if we've already been here
-	target * data = (target *)digraph_node_get_data(m->graph, node);
-	if(visited(visited_nodes, node)){
-		if(verbose) fprintf(m->output, "Cycle detected on %s. Skipping\n", data->name);
-		return true;
-	} else {
-		// Add the node
-		add_node(visited_nodes, node);
+// Adds node to the plan; jobs end up in the order a serial build would run
+// them in.
+static void add_job(job_plan * plan, digraph_node_t * node, target * data){
+	if(plan->cursize == plan->maxsize){
+		plan->maxsize *= 2;
+		plan->jobs = realloc(plan->jobs, sizeof(job *) * plan->maxsize);
 	}
+	job * j = calloc(CSIZE, sizeof(job));
+	j->data = data;
+	j->node = node;
+	j->order = plan->cursize;
+	data->job = j;
+	plan->jobs[plan->cursize] = j;
+	plan->cursize++;
+}
+
+// Returns what planning decided for t in the current build; false if it
+// wasn't planned
+static bool planned(mymake_t * m, const target * t){
+	return t->visit_epoch == m->epoch && t->visit_result;
+}
+
+// Decides what needs to be built for node, whose dependencies have been
+// planned already. Nothing is executed here; every target whose recipe
+// would run is added to plan. Returns true if node would be built.
+static bool plan_target(mymake_t * m, digraph_node_t * node, target * data,
+						bool verbose, bool isfirst, job_plan * plan){
 
 	// Check if it has a target or not
 	if(data->rcount == 0 && !isfirst){
-		if(last_modification(data->name) == 0){
+		if(mymake_target_mtime(m, data) == 0){
 			fprintf(m->output, "No rule to build %s...\n", data->name);
+			m->unresolved = true;
 			return false;
 		} else {
 			// .h or .c file
@@ -235,10 +466,9 @@ static bool build(mymake_t * m, digraph_node_t * node, bool verbose,
 
 	if(num_deps == 0){
 		// No dependency, just check if we need to build this file
-		if(last_modification(data->name) == 0){
-			return execute_recipe((const char **)data->recipies, data->rcount,
-								  m->output, m->error, dryrun);
-
+		if(mymake_target_mtime(m, data) == 0){
+			if(data->rcount > 0) add_job(plan, node, data);
+			return true;
 		} else {
 			return false;
 		}
@@ -251,12 +481,20 @@ static bool build(mymake_t * m, digraph_node_t * node, bool verbose,
 
 			// Get the last_modification time for the dependency
 			dependency_data = (target *)digraph_node_get_data(m->graph, nextnode);
-			if(check_timestamp(dependency_data->name, data->name)){
+			if(check_timestamp(m, dependency_data, data)){
 				// build the dependency
 				if(verbose) fprintf(m->output, "Building: Dependency %s is newer than its target %s.\n", dependency_data->name, data->name);
-				if(build(m, nextnode, verbose, dryrun, false, visited_nodes)){
+				// Either it gets built first, or it already exists and is
+				// newer (or the target is missing)
+				if(planned(m, dependency_data) ||
+				   (data->rcount > 0 && mymake_target_mtime(m, dependency_data) != 0)){
 					built = true;
 				}
+			} else if(planned(m, dependency_data) &&
+					  dependency_data->rcount > 0){
+				// Not newer yet, but one of its own dependencies changed
+				if(verbose) fprintf(m->output, "Building: Dependency %s of %s is out of date.\n", dependency_data->name, data->name);
+				built = true;
 			} else {
 				if(verbose) fprintf(m->output, "Not Building: Dependency %s is not newer than its target %s.\n", dependency_data->name, data->name);
 			}
@@ -267,11 +505,8 @@ static bool build(mymake_t * m, digraph_node_t * node, bool verbose,
 	if(built){
 		// build this target
 		if(verbose) fprintf(m->output, "Building Target %s.\n", data->name);
-		if(isfirst && data->rcount == 0){
-			return true;
-		}
-		return execute_recipe((const char **)data->recipies, data->rcount,
-							  m->output, m->error, dryrun);
+		if(data->rcount > 0) add_job(plan, node, data);
+		return true;
 	} else {
 		if(verbose) fprintf(m->output, "No criteria met for building target %s.\n", data->name);
 		if(isfirst) fprintf(m->output, "No need to build %s...\n", data->name);
@@ -280,10 +515,599 @@ static bool build(mymake_t * m, digraph_node_t * node, bool verbose,
 
 }
 
+// What reach_target needs to know
+typedef struct plan_walk{
+	mymake_t * m;
+	digraph_node_t * goal;
+} plan_walk;
+
+// Called when planning first reaches node. A pattern rule may supply its
+// recipe, and with it more dependencies. Returns whether its dependencies
+// need to be planned: not for files without a rule, nor for targets that
+// depend on nothing that changed.
+static bool reach_target(digraph_t * d, digraph_node_t * node, void * userdata){
+	plan_walk * walk = (plan_walk *) userdata;
+	mymake_t * m = walk->m;
+	target * data = (target *)digraph_node_get_data(d, node);
+	if(m->dirty_only && data->dirty_epoch != m->epoch){
+		return false;
+	}
+	mymake_match_pattern(m, node, data);
+	return data->rcount > 0 || node == walk->goal;
+}
+
+// Plans every target goal depends on, each one once and after all of its
+// dependencies, in the order a recursive walk would finish them; the jobs
+// in plan end up in that order too. The graph has no cycles (see
+// remove_cycles), except perhaps for one a pattern rule closed during this
+// walk: a target in it sees false for the dependency that comes after it,
+// and the link is dropped once planning is done. Returns true if goal
+// would be built.
+static bool plan_build(mymake_t * m, digraph_node_t * goal, bool verbose,
+					   job_plan * plan){
+	plan_walk walk;
+	walk.m = m;
+	walk.goal = goal;
+	uint32_t * order = NULL;
+	unsigned int count = digraph_dependency_order(m->graph, &goal, 1, reach_target,
+												  &walk, &order);
+
+	for(unsigned int i = 0; i < count; i++){
+		digraph_node_t * node = digraph_node_from_id(m->graph, order[i]);
+		target * data = (target *)digraph_node_get_data(m->graph, node);
+		bool isfirst = node == goal;
+		if(m->dirty_only && data->dirty_epoch != m->epoch){
+			// Nothing it depends on changed since it was last up to date
+			if(isfirst) fprintf(m->output, "No need to build %s...\n", data->name);
+			continue;
+		}
+
+		uint64_t start = m->trace ? monotonic_us() : 0;
+		data->visit_epoch = m->epoch;
+		data->visit_result = plan_target(m, node, data, verbose, isfirst, plan);
+		if(m->trace){
+			trace_event(m->trace, data->name, "check", start, monotonic_us() - start, 0, 0);
+		}
+	}
+	free(order);
+	return planned(m, (target *)digraph_node_get_data(m->graph, goal));
+}
+
+// Connects every planned job to the planned jobs it depends on. A job
+// waits for each of its dependencies that is in the plan, whether or not
+// the planning walk reached that dependency through this job.
+static void link_jobs(mymake_t * m, job_plan * plan){
+	digraph_node_t * nextnode = NULL;
+	target * dependency_data = NULL;
+	unsigned int total = 0;
+
+	// First pass counts the waiters of every job
+	for(int i = 0; i < plan->cursize; i++){
+		job * j = plan->jobs[i];
+		unsigned int num_deps = digraph_node_outgoing_link_count(m->graph, j->node);
+		for(int k = 0; k < num_deps; k++){
+			digraph_node_get_link(m->graph, j->node, k, &nextnode);
+			dependency_data = (target *)digraph_node_get_data(m->graph, nextnode);
+			if(dependency_data->job){
+				dependency_data->job->wcount++;
+				total++;
+			}
+		}
+	}
+
+	// Second pass hands out slices of one shared array and fills them
+	plan->waiters = calloc(total + 1, sizeof(job *));
+	job ** slice = plan->waiters;
+	for(int i = 0; i < plan->cursize; i++){
+		plan->jobs[i]->waiters = slice;
+		slice += plan->jobs[i]->wcount;
+		plan->jobs[i]->wcount = 0;
+	}
+	for(int i = 0; i < plan->cursize; i++){
+		job * j = plan->jobs[i];
+		unsigned int num_deps = digraph_node_outgoing_link_count(m->graph, j->node);
+		for(int k = 0; k < num_deps; k++){
+			digraph_node_get_link(m->graph, j->node, k, &nextnode);
+			dependency_data = (target *)digraph_node_get_data(m->graph, nextnode);
+			if(dependency_data->job){
+				job * dep = dependency_data->job;
+				dep->waiters[dep->wcount] = j;
+				dep->wcount++;
+				j->pending++;
+			}
+		}
+	}
+}
+
+// Gives every job the estimated length of the longest chain of recipes
+// from its start to the end of the build, so that jobs on the critical path
+// are started first. A recipe is expected to take as long as it did last
+// time, or the average of the known durations if it has never run (every
+// recipe counts the same if none are known). Jobs come after all of their
+// dependencies in plan, so going backwards the jobs waiting on a job have
+// their priorities by the time it is reached.
+static void prioritize(mymake_t * m, job_plan * plan){
+	if(m->jobs == 1){
+		// Order doesn't change how long a serial build takes
+		return;
+	}
+
+	uint64_t known = 0;
+	uint64_t total = 0;
+	for(int i = 0; i < plan->cursize; i++){
+		job * j = plan->jobs[i];
+		uint64_t duration;
+		j->priority = 0;
+		if(m->db && statedb_get_duration(m->db, j->data->name, &duration)){
+			j->priority = duration + 1;
+			known++;
+			total += duration;
+		}
+	}
+	uint64_t fallback = known ? total / known + 1 : 1;
+
+	for(int i = plan->cursize - 1; i >= 0; i--){
+		job * j = plan->jobs[i];
+		uint64_t longest = 0;
+		for(int k = 0; k < j->wcount; k++){
+			if(j->waiters[k]->priority > longest){
+				longest = j->waiters[k]->priority;
+			}
+		}
+		j->priority = (j->priority ? j->priority : fallback) + longest;
+	}
+}
+
+// Ready jobs are kept in a binary heap on priority (see prioritize), and
+// after that on their serial build order. With a single job slot every
+// priority is 0, so recipes run in exactly the order a serial build would
+// run them.
+static bool runs_before(const job * a, const job * b){
+	if(a->priority != b->priority){
+		return a->priority > b->priority;
+	}
+	return a->order < b->order;
+}
+
+static void push_ready(job_heap * heap, job * j){
+	unsigned int i = heap->cursize;
+	heap->cursize++;
+	while(i > 0){
+		unsigned int parent = (i - 1) / 2;
+		if(!runs_before(j, heap->jobs[parent])) break;
+		heap->jobs[i] = heap->jobs[parent];
+		i = parent;
+	}
+	heap->jobs[i] = j;
+}
+
+static job * pop_ready(job_heap * heap){
+	job * top = heap->jobs[0];
+	heap->cursize--;
+	job * last = heap->jobs[heap->cursize];
+	unsigned int i = 0;
+	while(true){
+		unsigned int child = i * 2 + 1;
+		if(child >= heap->cursize) break;
+		if(child + 1 < heap->cursize &&
+		   runs_before(heap->jobs[child + 1], heap->jobs[child])){
+			child++;
+		}
+		if(!runs_before(heap->jobs[child], last)) break;
+		heap->jobs[i] = heap->jobs[child];
+		i = child;
+	}
+	heap->jobs[i] = last;
+	return top;
+}
+
+// Checks if recipes need to be timed, for the trace or for the durations
+// kept in the state database
+static bool timing(mymake_t * m){
+	return m->trace || m->db;
+}
+
+// Writes a recipe line of j as it is run
+static void print_command(mymake_t * m, job * j, const char * line){
+	if(m->capture){
+		capture_print(m->capture, j->slot, line, strlen(line));
+		capture_print(m->capture, j->slot, "\n", 1);
+	} else {
+		fprintf(m->output, "%s\n", line);
+	}
+}
+
+// Where the commands of j write their output, -1 to the same place as mymake
+static int command_output(mymake_t * m, job * j){
+	return m->capture ? capture_fd(m->capture, j->slot) : -1;
+}
+
+// Same for their errors
+static int command_error(mymake_t * m, job * j){
+	return m->capture ? capture_error_fd(m->capture, j->slot) : -1;
+}
+
+// Starts all the recipe lines of j in one shell. Each line is run as
+// { line
+// } || exit $?
+// so the recipe fails at the first line that does, as when every line has
+// a shell of its own; sh -e would miss a failure on the left of && or ||.
+// Afterwards j->line is at the last line, so j is done once that shell
+// exits.
+static bool start_script(mymake_t * m, job * j, bool dryrun){
+	mymake_buf script = {NULL, 0, 0};
+	for(int i = 0; i < j->data->rcount; i++){
+		const char * line = mymake_expand_line(m, j->data, j->data->recipies[i]);
+		if(!line){
+			fprintf(m->error, "Error: Unable to expand recipe for %s.\n", j->data->name);
+			free(script.data);
+			return false;
+		}
+		print_command(m, j, line);
+		static const char check[] = "\n} || exit $?\n";
+		mymake_buf_append(&script, "{ ", 2);
+		mymake_buf_append(&script, line, strlen(line));
+		mymake_buf_append(&script, check, sizeof(check) - 1);
+	}
+	j->line = j->data->rcount - 1;
+	if(dryrun){
+		free(script.data);
+		j->line++;
+		j->pid = 0;
+		return true;
+	}
+
+	fflush(m->output);
+	if(timing(m)) j->line_start = monotonic_us();
+	j->pid = start_script_command(script.data, command_output(m, j),
+			command_error(m, j));
+	free(script.data);
+	if(j->pid < 0){
+		fprintf(m->error, "Error: Unable to run recipe for %s.\n", j->data->name);
+		return false;
+	}
+	return true;
+}
+
+// Starts the next recipe line of j. Sets j->pid to 0 if there are no lines
+// left. Returns false if the command could not be started.
+static bool start_line(mymake_t * m, job * j, bool dryrun){
+	if(j->line == 0 && j->data->rcount > 1 &&
+	   (m->oneshell || m->oneshell_all || j->data->oneshell)){
+		return start_script(m, j, dryrun);
+	}
+	while(j->line < j->data->rcount){
+		const char * line = mymake_expand_line(m, j->data, j->data->recipies[j->line]);
+		if(!line){
+			fprintf(m->error, "Error: Unable to expand recipe for %s.\n", j->data->name);
+			return false;
+		}
+		print_command(m, j, line);
+		if(dryrun){
+			j->line++;
+			continue;
+		}
+
+		// Don't let the child's output overtake ours
+		fflush(m->output);
+		if(timing(m)) j->line_start = monotonic_us();
+		j->pid = start_command(line, command_output(m, j), command_error(m, j));
+		if(j->pid < 0){
+			fprintf(m->error, "Error: Unable to run recipe for %s.\n", j->data->name);
+			return false;
+		}
+		return true;
+	}
+	j->pid = 0;
+	return true;
+}
+
+// Hash of everything the recipe of j depends on: its expanded recipe lines,
+// and the names and contents of its dependencies. Contents are hashed
+// through m->db, so only files whose mtime changed are read.
+static uint64_t input_signature(mymake_t * m, job * j){
+	uint64_t sig = 0;
+	for(int i = 0; i < j->data->rcount; i++){
+		const char * line = mymake_expand_line(m, j->data, j->data->recipies[i]);
+		if(!line){
+			// The error shows up again when the line runs
+			line = j->data->recipies[i];
+		}
+		sig = hash_bytes(line, strlen(line) + 1, sig);
+	}
+
+	unsigned int num_deps = digraph_node_outgoing_link_count(m->graph, j->node);
+	digraph_node_t * nextnode = NULL;
+	for(int i = 0; i < num_deps; i++){
+		digraph_node_get_link(m->graph, j->node, i, &nextnode);
+		target * dep = (target *)digraph_node_get_data(m->graph, nextnode);
+		uint64_t mtime = mymake_target_mtime(m, dep);
+		uint64_t hash = 0;
+		if(mtime != 0 && !statedb_file_hash(m->db, dep->name, mtime, &hash)){
+			// Can't be read (a directory, for example); go by its mtime
+			hash = mtime;
+		}
+		sig = hash_bytes(dep->name, strlen(dep->name) + 1, sig);
+		sig = hash_bytes(&hash, sizeof(hash), sig);
+	}
+	return sig;
+}
+
+// Called when j is about to run with content hashing on. Returns true if
+// the target exists and its inputs are the same as when its recipe last
+// ran, in which case the recipe can be skipped.
+static bool inputs_unchanged(mymake_t * m, job * j, bool verbose, bool dryrun){
+	j->signature = input_signature(m, j);
+	j->record_signature = !dryrun;
+
+	uint64_t old;
+	if(mymake_target_mtime(m, j->data) == 0 ||
+	   !statedb_get_signature(m->db, j->data->name, &old) || old != j->signature){
+		return false;
+	}
+	if(verbose) fprintf(m->output, "Not Building: Inputs of %s are unchanged.\n", j->data->name);
+	return true;
+}
+
+// Adds j to the ready jobs
+static void make_ready(mymake_t * m, job_heap * ready, job * j){
+	if(timing(m)) j->ready_at = monotonic_us();
+	push_ready(ready, j);
+}
+
+// Marks j as done and releases the jobs that were waiting on it
+static void finish_job(mymake_t * m, job * j, job_heap * ready){
+	// The recipe has probably changed the file
+	j->data->mtime_epoch = 0;
+	j->data->ran_epoch = m->epoch;
+	note_touched(m, j->node);
+	if(j->record_signature){
+		statedb_set_signature(m->db, j->data->name, j->signature);
+	}
+	if(m->db && j->run_us > 0){
+		statedb_set_duration(m->db, j->data->name, j->run_us);
+	}
+	for(int i = 0; i < j->wcount; i++){
+		j->waiters[i]->pending--;
+		if(j->waiters[i]->pending == 0){
+			make_ready(m, ready, j->waiters[i]);
+		}
+	}
+}
+
+// Writes out the captured output of j, which stopped running
+static void release_output(mymake_t * m, job * j){
+	if(m->capture){
+		capture_finish(m->capture, j->slot);
+	}
+}
+
+// Checks if the system is too busy to start another recipe (see
+// mymake_set_throttle). If report is true, says why.
+static bool system_busy(mymake_t * m, unsigned int nrunning, bool report){
+	double load;
+	if(m->max_load > 0 && load_average(&load)){
+		// The load average trails the recipes that were just started, so
+		// each running one counts for at least 1
+		if(load < nrunning){
+			load = nrunning;
+		}
+		if(load >= m->max_load){
+			if(report){
+				fprintf(m->output, "Building: Holding back recipes, the load is %.2f.\n", load);
+			}
+			return true;
+		}
+	}
+	uint64_t available;
+	if(m->min_memory > 0 && available_memory(&available) && available < m->min_memory){
+		if(report){
+			fprintf(m->output, "Building: Holding back recipes, only %lluMB of memory is available.\n",
+					(unsigned long long)(available >> 20));
+		}
+		return true;
+	}
+	return false;
+}
+
+// Runs the planned jobs, keeping up to m->jobs recipes running at once. A
+// job is started as soon as every job it depends on has finished. After a
+// recipe fails no new commands are started, but running ones are waited for.
+static bool run_jobs(mymake_t * m, job_plan * plan, bool verbose, bool dryrun){
+	job_heap ready;
+	ready.jobs = calloc(plan->cursize + 1, sizeof(job *));
+	ready.cursize = 0;
+	job ** running = calloc(m->jobs, sizeof(job *));
+	unsigned int nrunning = 0;
+	bool * slot_busy = calloc(m->jobs, sizeof(bool));
+	bool failed = false;
+	bool throttle = !dryrun && (m->max_load > 0 || m->min_memory > 0);
+	bool held = false;       // Ready recipes are waiting for the system
+	uint64_t recheck_at = 0; // When to look at the system again while held
+
+	if(m->output_sync != MYMAKE_OUTPUT_DIRECT && !dryrun){
+		m->capture = capture_create(m->output, m->error, m->jobs,
+									m->output_sync == MYMAKE_OUTPUT_LIVE);
+		if(!m->capture){
+			fprintf(m->error, "Warning: Unable to capture the output of recipes.\n");
+		}
+	}
+
+	for(int i = 0; i < plan->cursize; i++){
+		if(plan->jobs[i]->pending == 0){
+			make_ready(m, &ready, plan->jobs[i]);
+		}
+	}
+
+	while(true){
+		// Fill the free job slots
+		while(!failed && ready.cursize > 0 && nrunning < m->jobs){
+			// There is always one recipe running, or the build couldn't finish
+			if(throttle && nrunning > 0){
+				if(held && monotonic_us() < recheck_at){
+					break;
+				}
+				if(system_busy(m, nrunning, verbose && !held)){
+					held = true;
+					recheck_at = monotonic_us() + THROTTLE_CHECK_MS * 1000;
+					break;
+				}
+			}
+			held = false;
+			job * j = pop_ready(&ready);
+			j->slot = 0;
+			while(slot_busy[j->slot]){
+				j->slot++;
+			}
+			if(timing(m)){
+				j->queue_us = monotonic_us() - j->ready_at;
+			}
+			if(m->trace){
+				trace_event(m->trace, j->data->name, "queue", j->ready_at,
+							j->queue_us, j->slot + 1, 0);
+			}
+			if(m->capture){
+				capture_start(m->capture, j->slot);
+			}
+
+			if(m->hashing && inputs_unchanged(m, j, verbose, dryrun)){
+				finish_job(m, j, &ready);
+			} else if(!start_line(m, j, dryrun)){
+				failed = true;
+			} else if(j->pid > 0){
+				slot_busy[j->slot] = true;
+				running[nrunning] = j;
+				nrunning++;
+				continue;
+			} else {
+				finish_job(m, j, &ready);
+			}
+			release_output(m, j);
+		}
+		if(nrunning == 0){
+			break;
+		}
+
+		// While recipes are held back, look at the system again every so often
+		bool polling = held && !failed && ready.cursize > 0 && nrunning < m->jobs;
+		int status;
+		pid_t pid;
+		if(m->capture){
+			pid = capture_wait(m->capture, &status, polling ? THROTTLE_POLL_MS : -1);
+		} else {
+			pid = waitpid(-1, &status, polling ? WNOHANG : 0);
+			if(pid == 0){
+				struct timespec pause = {0, THROTTLE_POLL_MS * 1000000L};
+				nanosleep(&pause, NULL);
+			}
+		}
+		if(pid == 0){
+			continue;
+		}
+		if(pid < 0){
+			if(errno == EINTR) continue;
+			fprintf(m->error, "Error: Lost track of running recipes.\n");
+			failed = true;
+			break;
+		}
+
+		unsigned int idx = 0;
+		while(idx < nrunning && running[idx]->pid != pid){
+			idx++;
+		}
+		if(idx == nrunning){
+			// Not one of ours
+			continue;
+		}
+
+		job * j = running[idx];
+		if(timing(m)){
+			uint64_t duration = monotonic_us() - j->line_start;
+			j->run_us += duration;
+			if(m->trace){
+				trace_event(m->trace, j->data->name, "recipe", j->line_start,
+							duration, j->slot + 1, (long)pid);
+			}
+		}
+		bool succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		if(succeeded && !failed){
+			j->line++;
+			if(!start_line(m, j, dryrun)){
+				failed = true;
+			} else if(j->pid > 0){
+				// Still running its next line
+				continue;
+			} else {
+				finish_job(m, j, &ready);
+			}
+		}
+		// What the recipe wrote comes out before the error about it
+		release_output(m, j);
+		if(!succeeded){
+			fprintf(m->error, "Error: Recipe for %s failed.\n", j->data->name);
+			failed = true;
+		}
+
+		// j is no longer running, which may have freed up the system
+		slot_busy[j->slot] = false;
+		recheck_at = 0;
+		nrunning--;
+		running[idx] = running[nrunning];
+	}
+
+	if(m->capture){
+		capture_destroy(m->capture);
+		m->capture = NULL;
+	}
+	free(running);
+	free(slot_busy);
+	free(ready.jobs);
+	return !failed;
+}
+
+// Orders jobs from the longest running recipe to the shortest
+static int slower_first(const void * a, const void * b){
+	const job * ja = *(const job * const *)a;
+	const job * jb = *(const job * const *)b;
+	if(ja->run_us != jb->run_us){
+		return ja->run_us > jb->run_us ? -1 : 1;
+	}
+	return 0;
+}
+
+// Lists the jobs of plan whose recipes took the longest
+static void print_slowest(mymake_t * m, const job_plan * plan){
+	if(plan->cursize == 0){
+		return;
+	}
+	job ** jobs = calloc(plan->cursize, sizeof(job *));
+	memcpy(jobs, plan->jobs, plan->cursize * sizeof(job *));
+	qsort(jobs, plan->cursize, sizeof(job *), slower_first);
+
+	fprintf(m->output, "Slowest targets:\n");
+	for(int i = 0; i < plan->cursize && i < SLOWEST_COUNT && jobs[i]->run_us > 0; i++){
+		fprintf(m->output, "%10.3fs  %s (waited %.3fs)\n", jobs[i]->run_us / 1e6,
+				jobs[i]->data->name, jobs[i]->queue_us / 1e6);
+	}
+	free(jobs);
+}
+
+static void free_plan(job_plan * plan){
+	for(int i = 0; i < plan->cursize; i++){
+		plan->jobs[i]->data->job = NULL;
+		free(plan->jobs[i]);
+	}
+	free(plan->jobs);
+	free(plan->waiters);
+}
+
 bool mymake_build(mymake_t * m, const char * target, bool verbose, bool dryrun){
 	digraph_node_t * target_node = NULL;
 	if(target){
-		target_node = digraph_find(m->graph, findnode, (void *)target);
+		target_node = find_target(m, target);
+		if(!target_node){
+			target_node = mymake_pattern_target(m, target);
+		}
 		if(!target_node){
 			fprintf(m->error, "Error: Unable to find target %s.\n", target);
 			return false;
@@ -295,17 +1119,150 @@ bool mymake_build(mymake_t * m, const char * target, bool verbose, bool dryrun){
 		}
 	}
 
-	// Build the node
-	unsigned int size = digraph_node_outgoing_link_count(m->graph, target_node);
-	node_array * checked_nodes = new_node_array(size+1);
-	bool built = build(m, target_node, verbose, dryrun, true, checked_nodes);
-	free_node_array(checked_nodes);
+	// Loading is done (or mostly so); pack the links for the walk below
+	digraph_freeze(m->graph);
+	if(!m->acyclic){
+		remove_cycles(m);
+		digraph_freeze(m->graph);
+	}
+
+	// Start a new epoch, which invalidates every cached mtime
+	m->epoch++;
+	m->stat_calls = 0;
+	m->stat_saved = 0;
+	m->unresolved = false;
+	struct target * goal = digraph_node_get_data(m->graph, target_node);
+	m->dirty_only = m->incremental && mark_dirty(m, goal, verbose);
+	if(!m->dirty_only){
+		mymake_prefetch_mtimes(m, target_node);
+		if(!m->acyclic){
+			// Pattern rules applied on the way added links
+			remove_cycles(m);
+		}
+	}
+
+	// Work out what needs to be built
+	job_plan plan;
+	plan.maxsize = INITJOBS;
+	plan.cursize = 0;
+	plan.jobs = calloc(plan.maxsize, sizeof(job *));
+	plan.waiters = NULL;
+	bool built = plan_build(m, target_node, verbose, &plan);
+	if(!m->acyclic){
+		// Pattern rules added links, which mustn't make jobs wait on each other
+		remove_cycles(m);
+	}
+
+	// Then build it
+	link_jobs(m, &plan);
+	prioritize(m, &plan);
+	if(!run_jobs(m, &plan, verbose, dryrun)){
+		built = false;
+	} else if(m->incremental && !dryrun && !m->unresolved){
+		goal->checked_epoch = m->epoch;
+	}
+	m->dirty_only = false;
+	if(m->trace){
+		print_slowest(m, &plan);
+		trace_flush(m->trace);
+	}
+	free_plan(&plan);
+	if(m->db && !statedb_save(m->db)){
+		fprintf(m->error, "Warning: Unable to save the state database.\n");
+	}
+	if(verbose) fprintf(m->output, "Checked %lu files, %lu stat calls saved.\n",
+						m->stat_calls, m->stat_saved);
 	return built;
+}
+
+void mymake_set_trace(mymake_t * m, trace_t * trace){
+	m->trace = trace;
+}
+
+void mymake_keep_mtimes(mymake_t * m, bool keep){
+	m->keep_mtimes = keep;
+}
+
+void mymake_set_incremental(mymake_t * m, bool incremental){
+	m->incremental = incremental;
+}
+
+bool mymake_touched(mymake_t * m, const char * name){
+	digraph_node_t * node = find_target(m, name);
+	if(!node){
+		return false;
+	}
+	((target *)digraph_node_get_data(m->graph, node))->mtime_epoch = 0;
+	note_touched(m, node);
+	return true;
+}
+
+bool mymake_recipe_ran(mymake_t * m, const char * name, unsigned int builds){
+	digraph_node_t * node = find_target(m, name);
+	if(!node){
+		return false;
+	}
+	target * t = (target *)digraph_node_get_data(m->graph, node);
+	return t->ran_epoch != 0 && m->epoch - t->ran_epoch < builds;
+}
+
+void mymake_visit_sources(mymake_t * m, mymake_name_cb_t cb, void * userdata){
+	unsigned int count = digraph_node_id_limit(m->graph);
+	for(unsigned int i = 0; i < count; i++){
+		digraph_node_t * node = digraph_node_from_id(m->graph, i);
+		if(!node){
+			continue;
+		}
+		target * t = (target *)digraph_node_get_data(m->graph, node);
+		if(t->rcount == 0){
+			cb(userdata, t->name);
+		}
+	}
+}
+
+void mymake_set_oneshell(mymake_t * m, bool oneshell){
+	m->oneshell = oneshell;
+}
 
+bool mymake_use_state_db(mymake_t * m, const char * path, bool hashing){
+	assert(!m->db);
+	m->db = statedb_load(path);
+	if(!m->db){
+		fprintf(m->error, "Error: Unable to read the state database %s.\n", path);
+		return false;
+	}
+	m->hashing = hashing;
+	return true;
+}
+
+void mymake_set_jobs(mymake_t * m, unsigned int jobs){
+	assert(jobs > 0);
+	m->jobs = jobs;
+}
+
+void mymake_set_output_sync(mymake_t * m, int mode){
+	assert(mode == MYMAKE_OUTPUT_DIRECT || mode == MYMAKE_OUTPUT_JOB ||
+		   mode == MYMAKE_OUTPUT_LIVE);
+	m->output_sync = mode;
+}
 
+void mymake_set_throttle(mymake_t * m, double max_load, uint64_t min_memory){
+	assert(max_load >= 0);
+	m->max_load = max_load;
+	m->min_memory = min_memory;
 }
 
 void mymake_destroy(mymake_t * m){
+	// Targets are released all at once with the arena
 	digraph_destroy(m->graph);
+	mymake_close_cache(m);
+	if(m->db) statedb_destroy(m->db);
+	mymake_free_vars(m);
+	mymake_free_patterns(m);
+	arena_destroy(m->arena);
+	strtab_destroy(m->names);
+	free(m->byname);
+	free(m->touched);
+	free(m->touched_epochs);
 	free(m);
 }
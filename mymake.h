@@ -2,6 +2,9 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "trace.h"
 
 struct mymake_t;
 typedef struct mymake_t mymake_t;
@@ -20,6 +23,12 @@ bool mymake_supports_variables();
 bool mymake_add_variable(mymake_t * m, const char * varname, const char *
         val);
 
+/// Interns the len characters at str (which need not be NUL-terminated) in
+/// the table mymake uses for target names, and returns the stored copy.
+/// The copy remains valid until mymake_destroy. Passing interned names to
+/// mymake_add_target saves it from copying them again.
+const char * mymake_intern(mymake_t * m, const char * str, size_t len);
+
 /// Adds a new target. deps and recipe are NOT modified and the strings
 /// they point to do not need to remain valid after this call returns.
 /// Returns false if there was a problem (for example the target
@@ -27,6 +36,11 @@ bool mymake_add_variable(mymake_t * m, const char * varname, const char *
 bool mymake_add_target(mymake_t * m, const char * name, const char ** deps,
         unsigned int depcount, const char ** recipe, unsigned int recipecount);
 
+/// Makes every line of the recipes of the count named targets run in a
+/// single shell, which stops after the first line that fails, so that lines
+/// can share state such as the working directory. With count == 0 this
+/// applies to every recipe. Used for .ONESHELL rules.
+void mymake_add_oneshell(mymake_t * m, const char ** targets, unsigned int count);
 
 // If target == 0, build the default target (the first target that
 // was added).
@@ -44,6 +58,104 @@ bool mymake_add_target(mymake_t * m, const char * name, const char ** deps,
 // to output.
 bool mymake_build(mymake_t * m, const char * target, bool verbose, bool dryrun);
 
+// Sets the maximum number of recipes mymake_build runs at the same time.
+// Recipes are started as soon as all of their dependencies are built; when
+// several could start, the ones with the longest chain of recipes after
+// them go first. The default is 1, which builds targets one at a time in
+// the same order as a serial build. jobs must be at least 1.
+void mymake_set_jobs(mymake_t * m, unsigned int jobs);
+
+// How mymake_build shows what recipes write to stdout and stderr
+#define MYMAKE_OUTPUT_DIRECT 0   // As it comes (the default)
+#define MYMAKE_OUTPUT_JOB 1      // All at once when the recipe is done
+#define MYMAKE_OUTPUT_LIVE 2     // As it comes for the oldest running recipe,
+                                 // when that one is done for the others
+
+// Sets how the output of recipes is shown: one of MYMAKE_OUTPUT_*. Except
+// with MYMAKE_OUTPUT_DIRECT, the output (and the command lines mymake
+// writes) of recipes running at the same time isn't interleaved. What
+// recipes write to stderr still goes to the error file, after their stdout.
+void mymake_set_output_sync(mymake_t * m, int mode);
+
+// Holds back new recipes while the load average is at least max_load, or
+// while fewer than min_memory bytes of memory are available (counting the
+// memory limit of mymake's cgroup). 0 turns either limit off, which is the
+// default. One recipe is always allowed to run, so a build still finishes
+// on a machine that stays busy.
+void mymake_set_throttle(mymake_t * m, double max_load, uint64_t min_memory);
+
+// Runs every recipe in a single shell, as if the makefile had a
+// .ONESHELL rule without targets (see mymake_add_oneshell)
+void mymake_set_oneshell(mymake_t * m, bool oneshell);
+
+// Keeps what mymake learns about files and recipes in the database at path:
+// how long each recipe took, which mymake_build uses to start the recipes
+// on the longest chain first when running more than one job at a time, and
+// the content hashes used by hashing.
+//
+// With hashing on, a recipe whose target exists is skipped if the contents
+// of its dependencies (and the recipe itself) are the same as the last time
+// it ran, even if their mtimes say otherwise. Files are only re-read when
+// their mtime changes.
+//
+// Returns false if the database can't be read.
+bool mymake_use_state_db(mymake_t * m, const char * path, bool hashing);
+
+// Records how long each target took to check, waited for a free job slot
+// and spent running its recipe in trace, and makes mymake_build list the
+// slowest recipes once it's done. trace is not closed by mymake_destroy.
+// NULL turns tracing off.
+void mymake_set_trace(mymake_t * m, trace_t * trace);
+
+// Makes the modification times read during one mymake_build valid for the
+// following ones too, so files aren't checked again on every build. Files
+// that change in between must be reported with mymake_touched.
+void mymake_keep_mtimes(mymake_t * m, bool keep);
+
+// Forgets what is known about the file name, so the next build checks it
+// again. Returns true if name is a target or dependency.
+bool mymake_touched(mymake_t * m, const char * name);
+
+// Returns true if the recipe of the target name ran during one of the last
+// builds calls to mymake_build
+bool mymake_recipe_ran(mymake_t * m, const char * name, unsigned int builds);
+
+// Makes a build of a target that an earlier mymake_build brought up to date
+// only check what depends on files changed since: the ones reported with
+// mymake_touched, and targets whose recipes ran. The rest of the graph
+// isn't visited. Files must not change without being reported, so this is
+// meant to go with mymake_keep_mtimes.
+void mymake_set_incremental(mymake_t * m, bool incremental);
+
+typedef void (*mymake_name_cb_t) (void * userdata, const char * name);
+
+// Calls cb with the name of every target or dependency without a recipe,
+// i.e. every file mymake only reads
+void mymake_visit_sources(mymake_t * m, mymake_name_cb_t cb, void * userdata);
+
+// Identifies the version of a makefile a graph cache was made from. A cache
+// is only used while the makefile has the same device, inode, size and
+// modification time as when the cache was written.
+typedef struct mymake_cache_key{
+	uint64_t device;
+	uint64_t inode;
+	uint64_t size;
+	uint64_t mtime;
+} mymake_cache_key;
+
+// Fills in key for the named makefile. Returns false if it can't be stat()ed.
+bool mymake_cache_key_for(const char * makefile, mymake_cache_key * key);
+
+// Writes a binary snapshot of every target added to m (names, links and
+// recipes) to path, tagged with key. Returns false if it couldn't be written.
+bool mymake_save_cache(mymake_t * m, const char * path, const mymake_cache_key * key);
+
+// Loads the snapshot at path into m, which must not have any targets yet.
+// The file is memory mapped and recipe lines are used from the mapping
+// directly. Returns false (leaving m unchanged) if the file is missing,
+// damaged, or was written for a different key.
+bool mymake_load_cache(mymake_t * m, const char * path, const mymake_cache_key * key);
+
 // DOES NOT CLOSE THE FILES PASSED IN WITH mymake_create
 void mymake_destroy(mymake_t * m);
 
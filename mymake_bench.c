@@ -0,0 +1,338 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mymake.h"
+#include "makefile_parser.h"
+#include "util.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+/**
+ * Generates a makefile of a given shape, creates the files it names, and
+ * measures how long mymake takes to parse it, build its graph, save and
+ * load the graph cache, and find that nothing needs to be built. The
+ * results are written to stdout as a single line of JSON.
+ *
+ * The targets are spread evenly over depth layers. Each target depends on
+ * fanin targets of the layer below it; the bottom layer depends on source
+ * files, of which there are as many as there are targets in a layer. A
+ * target called all depends on the whole top layer. Every file is created
+ * older than the targets that depend on it, so the build has nothing to do.
+ */
+
+// Name of the generated makefile, inside the benchmark directory
+#define BENCH_MAKEFILE "Makefile.mymake"
+#define BENCH_CACHE "Makefile.mymake.cache"
+// Modification time of the source files; each layer is a second newer
+#define BASE_TIME 1000000000
+
+// Shape of the generated makefile
+typedef struct shape{
+	unsigned long targets;
+	unsigned int depth;
+	unsigned int fanin;
+	unsigned int recipe_lines;
+	unsigned int recipe_len;
+	unsigned long seed;
+} shape;
+
+// Picks the dependencies; the same seed always gives the same makefile
+static uint64_t next_random(uint64_t * state){
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// Number of targets in each layer (and of source files)
+static unsigned long layer_size(const shape * s){
+	unsigned long size = s->targets / s->depth;
+	return size ? size : 1;
+}
+
+// Writes the name of file index of layer (0 for the sources) to buf
+static void file_name(char * buf, size_t size, unsigned int layer, unsigned long index){
+	snprintf(buf, size, "l%u/f%lu", layer, index);
+}
+
+static bool write_makefile(const shape * s, const char * path){
+	FILE * f = fopen(path, "w");
+	if(!f){
+		return false;
+	}
+	unsigned long size = layer_size(s);
+	uint64_t state = s->seed ? s->seed : 1;
+	char name[64];
+
+	fprintf(f, "all:");
+	for(unsigned long i = 0; i < size; i++){
+		file_name(name, sizeof(name), s->depth, i);
+		fprintf(f, " %s", name);
+	}
+	fprintf(f, "\n\n");
+
+	for(unsigned int layer = 1; layer <= s->depth; layer++){
+		for(unsigned long i = 0; i < size; i++){
+			file_name(name, sizeof(name), layer, i);
+			fprintf(f, "%s:", name);
+			for(unsigned int k = 0; k < s->fanin; k++){
+				// The first dependency covers the whole layer below, so every
+				// file in it is used
+				unsigned long dep = k == 0 ? i : next_random(&state) % size;
+				file_name(name, sizeof(name), layer - 1, dep);
+				fprintf(f, " %s", name);
+			}
+			fprintf(f, "\n");
+			for(unsigned int r = 0; r < s->recipe_lines; r++){
+				fprintf(f, "\techo");
+				for(unsigned int c = 4; c < s->recipe_len; c++){
+					fputc(c == 4 ? ' ' : 'x', f);
+				}
+				fprintf(f, "\n");
+			}
+			fprintf(f, "\n");
+		}
+	}
+	return fclose(f) == 0;
+}
+
+// Creates every source and target file, each layer newer than the one below
+static bool create_files(const shape * s){
+	unsigned long size = layer_size(s);
+	char name[64];
+	for(unsigned int layer = 0; layer <= s->depth; layer++){
+		snprintf(name, sizeof(name), "l%u", layer);
+		if(mkdir(name, 0755) != 0 && errno != EEXIST){
+			return false;
+		}
+		struct timespec times[2];
+		times[0].tv_sec = times[1].tv_sec = BASE_TIME + layer;
+		times[0].tv_nsec = times[1].tv_nsec = 0;
+		for(unsigned long i = 0; i < size; i++){
+			file_name(name, sizeof(name), layer, i);
+			int fd = open(name, O_WRONLY | O_CREAT, 0644);
+			if(fd < 0){
+				return false;
+			}
+			futimens(fd, times);
+			close(fd);
+		}
+	}
+	return true;
+}
+
+bool skip_rule(void * userdata, const mfp_slice_t * target, unsigned int tcount,
+			   const mfp_slice_t * dependencies, unsigned int dcount,
+			   const mfp_slice_t * recipe, unsigned int rcount){
+	return true;
+}
+
+bool skip_variable(void * userdata, unsigned int line, const char * varname,
+				   const char * value){
+	return true;
+}
+
+// What the callbacks of the parse into the graph work on. They time
+// themselves, so that the graph building is measured apart from the
+// parsing it is interleaved with; the cost of reading the clock that adds
+// is taken off afterwards (see timer_overhead).
+typedef struct graph_load{
+	mymake_t * m;
+	uint64_t graph_us;    // Spent interning names and adding targets
+	unsigned long timed;  // Number of intervals in graph_us
+} graph_load;
+
+const char * intern_name(void * userdata, const char * str, size_t len){
+	graph_load * load = (graph_load *) userdata;
+	uint64_t start = monotonic_us();
+	const char * name = mymake_intern(load->m, str, len);
+	load->graph_us += monotonic_us() - start;
+	load->timed++;
+	return name;
+}
+
+bool add_rule(void * userdata, const char ** target, unsigned int tcount,
+			  const char ** dependencies, unsigned int dcount,
+			  const char ** recipe, unsigned int rcount){
+	graph_load * load = (graph_load *) userdata;
+	uint64_t start = monotonic_us();
+	bool added = true;
+	for(int i = 0; i < tcount && added; i++){
+		added = mymake_add_target(load->m, target[i], dependencies, dcount, recipe, rcount);
+	}
+	load->graph_us += monotonic_us() - start;
+	load->timed++;
+	return added;
+}
+
+// Measures what timing an interval like the callbacks above do costs, in
+// microseconds per interval: how much of it lands inside the interval
+// (*inside), and how much the two clock reads add to the run (*total)
+static void timer_overhead(double * inside, double * total){
+	const unsigned long rounds = 1000000;
+	uint64_t sum = 0;
+	uint64_t start = monotonic_us();
+	for(unsigned long i = 0; i < rounds; i++){
+		uint64_t begin = monotonic_us();
+		sum += monotonic_us() - begin;
+	}
+	*total = (double)(monotonic_us() - start) / rounds;
+	*inside = (double)sum / rounds;
+}
+
+// Milliseconds since start
+static double elapsed_ms(uint64_t start){
+	return (monotonic_us() - start) / 1000.0;
+}
+
+static void usage(void){
+	fprintf(stderr, "\
+Usage: mymake_bench [-n targets] [-d depth] [-k fanin] [-r lines]\n\
+                    [-L length] [-s seed] [-o dir]\n\n\
+\t-n targets\t number of targets (default 10000)\n\
+\t-d depth\t number of layers they are spread over (default 8)\n\
+\t-k fanin\t dependencies of each target (default 4)\n\
+\t-r lines\t recipe lines of each target (default 1)\n\
+\t-L length\t characters in each recipe line (default 40)\n\
+\t-s seed\t\t picks the dependencies (default 1)\n\
+\t-o dir\t\t where the files are created (default\n\
+\t\t\t /dev/shm/mymake-bench); its old contents are kept\n");
+}
+
+// Reads a positive number for option opt
+static bool parse_count(int opt, const char * text, unsigned long * value){
+	char * end = NULL;
+	*value = strtoul(text, &end, 10);
+	if(end == text || *end != '\0' || *value == 0 || *text == '-'){
+		fprintf(stderr, "Invalid value %s for -%c.\n", text, opt);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char * argv[]){
+	shape s;
+	s.targets = 10000;
+	s.depth = 8;
+	s.fanin = 4;
+	s.recipe_lines = 1;
+	s.recipe_len = 40;
+	s.seed = 1;
+	const char * dir = "/dev/shm/mymake-bench";
+
+	int c;
+	unsigned long value;
+	while((c = getopt(argc, argv, "hn:d:k:r:L:s:o:")) != -1){
+		if(c == 'o'){
+			dir = optarg;
+			continue;
+		}
+		if(c == 'h' || c == '?'){
+			usage();
+			return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+		if(!parse_count(c, optarg, &value)){
+			return EXIT_FAILURE;
+		}
+		switch(c){
+		case 'n': s.targets = value; break;
+		case 'd': s.depth = value; break;
+		case 'k': s.fanin = value; break;
+		case 'r': s.recipe_lines = value; break;
+		case 'L': s.recipe_len = value; break;
+		case 's': s.seed = value; break;
+		}
+	}
+
+	if(mkdir(dir, 0755) != 0 && errno != EEXIST){
+		fprintf(stderr, "Unable to create %s.\n", dir);
+		return EXIT_FAILURE;
+	}
+	if(chdir(dir) != 0){
+		fprintf(stderr, "Unable to use %s.\n", dir);
+		return EXIT_FAILURE;
+	}
+
+	uint64_t start = monotonic_us();
+	if(!write_makefile(&s, BENCH_MAKEFILE) || !create_files(&s)){
+		fprintf(stderr, "Unable to create the files in %s.\n", dir);
+		return EXIT_FAILURE;
+	}
+	double generate_ms = elapsed_ms(start);
+	struct stat st;
+	stat(BENCH_MAKEFILE, &st);
+
+	// Parsing alone: names are neither copied nor interned
+	mfp_cb_t parser;
+	parser.rule_cb = NULL;
+	parser.rule_slice_cb = skip_rule;
+	parser.variable_cb = skip_variable;
+	parser.intern = NULL;
+	parser.oneshell_cb = NULL;
+	parser.error = stderr;
+	start = monotonic_us();
+	if(!mfp_parse_path(BENCH_MAKEFILE, &parser, NULL)){
+		return EXIT_FAILURE;
+	}
+	double parse_ms = elapsed_ms(start);
+
+	// Parsing into the graph, like mymake does without a cache
+	FILE * devnull = fopen("/dev/null", "w");
+	mymake_t * m = mymake_create(devnull, stderr);
+	parser.rule_cb = add_rule;
+	parser.rule_slice_cb = NULL;
+	parser.intern = intern_name;
+	graph_load load;
+	load.m = m;
+	load.graph_us = 0;
+	load.timed = 0;
+	double inside_us, total_us;
+	timer_overhead(&inside_us, &total_us);
+	start = monotonic_us();
+	if(!mfp_parse_path(BENCH_MAKEFILE, &parser, &load)){
+		return EXIT_FAILURE;
+	}
+	double load_ms = elapsed_ms(start) - load.timed * total_us / 1000.0;
+	double graph_ms = (load.graph_us - load.timed * inside_us) / 1000.0;
+
+	mymake_cache_key key;
+	mymake_cache_key_for(BENCH_MAKEFILE, &key);
+	start = monotonic_us();
+	bool saved = mymake_save_cache(m, BENCH_CACHE, &key);
+	double cache_save_ms = elapsed_ms(start);
+	mymake_destroy(m);
+
+	m = mymake_create(devnull, stderr);
+	start = monotonic_us();
+	bool loaded = saved && mymake_load_cache(m, BENCH_CACHE, &key);
+	double cache_load_ms = elapsed_ms(start);
+	if(!loaded){
+		fprintf(stderr, "Unable to use the graph cache.\n");
+		return EXIT_FAILURE;
+	}
+
+	start = monotonic_us();
+	mymake_build(m, "all", false, false);
+	double noop_ms = elapsed_ms(start);
+	mymake_destroy(m);
+	fclose(devnull);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("{\"targets\": %lu, \"depth\": %u, \"fanin\": %u, \"recipe_lines\": %u, "
+		   "\"recipe_len\": %u, \"makefile_bytes\": %lld, \"generate_ms\": %.1f, "
+		   "\"parse_ms\": %.2f, \"load_ms\": %.2f, \"graph_ms\": %.2f, "
+		   "\"cache_save_ms\": %.2f, \"cache_load_ms\": %.2f, \"noop_build_ms\": %.2f, "
+		   "\"peak_rss_kb\": %ld}\n",
+		   layer_size(&s) * s.depth, s.depth, s.fanin, s.recipe_lines, s.recipe_len,
+		   (long long)st.st_size, generate_ms, parse_ms, load_ms, graph_ms,
+		   cache_save_ms, cache_load_ms, noop_ms, usage.ru_maxrss);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,472 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mymake_internal.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+/**
+ * Graph cache file layout. Everything is stored in the byte order of the
+ * machine that wrote it; the cache is only meant for reuse on that machine.
+ *
+ *   cache_header
+ *   cache_node nodes[node_count]         In node id order
+ *   uint32_t edges[edge_count]           Node ids, padded to 8 bytes
+ *   uint64_t recipe_offsets[recipe_count]
+ *   cache_pattern patterns[pattern_count]
+ *   char text[text_size]                 NUL-terminated strings
+ *
+ * text starts with every name, back to back in name id order, so interning
+ * them in order on an empty mymake_t gives every name the id it had when
+ * the cache was written. The variables follow, each as its name and then
+ * its value, in variable id order, and every pattern rule as its target,
+ * dependencies and recipe lines; then the recipe lines of the nodes.
+ */
+
+#define CACHE_MAGIC "MYMKGC\0\0"
+#define CACHE_VERSION 4
+#define CACHE_NONE UINT32_MAX
+
+// cache_header flags
+#define CACHE_ONESHELL_ALL 1      // The makefile had a .ONESHELL rule without targets
+// cache_node flags
+#define NODE_ONESHELL 1           // Recipe runs in a single shell
+
+typedef struct cache_header{
+	char magic[8];
+	uint32_t version;
+	uint32_t first_node;      // Node id of firstnode, CACHE_NONE if none
+	mymake_cache_key key;
+	uint32_t name_count;
+	uint32_t node_count;
+	uint32_t edge_count;
+	uint32_t recipe_count;
+	uint32_t flags;           // CACHE_ flags
+	uint32_t var_count;
+	uint32_t pattern_count;
+	uint32_t reserved;        // Always 0
+	uint64_t text_size;
+} cache_header;
+
+typedef struct cache_node{
+	uint32_t name_id;
+	uint32_t flags;           // NODE_ flags
+	uint32_t edge_start;      // Index of the first link in edges
+	uint32_t edge_count;
+	uint32_t recipe_start;    // Index of the first line in recipe_offsets
+	uint32_t recipe_count;
+} cache_node;
+
+typedef struct cache_pattern{
+	uint32_t dep_count;
+	uint32_t recipe_count;
+} cache_pattern;
+
+// Pointers to the sections of a mapped cache file
+typedef struct cache_view{
+	const cache_header * header;
+	const cache_node * nodes;
+	const uint32_t * edges;
+	const uint64_t * recipe_offsets;
+	const cache_pattern * patterns;
+	const char * text;
+} cache_view;
+
+static size_t pad8(size_t size){
+	return (size + 7) / 8 * 8;
+}
+
+// Works out where each section starts. Returns the size the file must have.
+static uint64_t layout(const cache_header * h, size_t offsets[5]){
+	uint64_t pos = sizeof(cache_header);
+	offsets[0] = pos;
+	pos += (uint64_t)h->node_count * sizeof(cache_node);
+	offsets[1] = pos;
+	pos += pad8((uint64_t)h->edge_count * sizeof(uint32_t));
+	offsets[2] = pos;
+	pos += (uint64_t)h->recipe_count * sizeof(uint64_t);
+	offsets[3] = pos;
+	pos += (uint64_t)h->pattern_count * sizeof(cache_pattern);
+	offsets[4] = pos;
+	return pos + h->text_size;
+}
+
+bool mymake_cache_key_for(const char * makefile, mymake_cache_key * key){
+	struct stat statinfo;
+	if(stat(makefile, &statinfo) < 0){
+		return false;
+	}
+	memset(key, 0, sizeof(mymake_cache_key));
+	key->device = statinfo.st_dev;
+	key->inode = statinfo.st_ino;
+	key->size = statinfo.st_size;
+	key->mtime = (uint64_t)statinfo.st_mtim.tv_sec * 1000000000llu + statinfo.st_mtim.tv_nsec;
+	return true;
+}
+
+// Checks that every offset and index in the mapped file is in range, and
+// that no two nodes have the same name, so the loader doesn't need to
+static bool check_view(const cache_view * v){
+	const cache_header * h = v->header;
+	// Every name takes at least its NUL, which also bounds the bitmap below
+	if(h->text_size == 0 || v->text[h->text_size - 1] != '\0' ||
+	   h->name_count > h->text_size){
+		return false;
+	}
+	for(uint32_t i = 0; i < h->recipe_count; i++){
+		if(v->recipe_offsets[i] >= h->text_size) return false;
+	}
+	uint8_t * named = calloc(h->name_count / 8 + 1, 1);
+	for(uint32_t i = 0; i < h->node_count; i++){
+		const cache_node * n = &v->nodes[i];
+		if(n->name_id >= h->name_count ||
+		   (named[n->name_id / 8] & (1u << (n->name_id % 8))) ||
+		   (uint64_t)n->edge_start + n->edge_count > h->edge_count ||
+		   (uint64_t)n->recipe_start + n->recipe_count > h->recipe_count){
+			free(named);
+			return false;
+		}
+		named[n->name_id / 8] |= 1u << (n->name_id % 8);
+	}
+	free(named);
+	for(uint32_t i = 0; i < h->edge_count; i++){
+		if(v->edges[i] >= h->node_count) return false;
+	}
+	if(h->first_node != CACHE_NONE && h->first_node >= h->node_count){
+		return false;
+	}
+	return true;
+}
+
+// Moves pos past the string that starts there. Returns false if it is past
+// the end of text; as text ends in a NUL, a string that starts in it also
+// ends in it.
+static bool skip_string(const cache_view * v, uint64_t * pos){
+	if(*pos >= v->header->text_size){
+		return false;
+	}
+	*pos += strlen(v->text + *pos) + 1;
+	return true;
+}
+
+// Checks that text holds every name, variable and pattern rule the header
+// says it does, and that mymake_add_pattern will take each of the rules
+static bool check_strings(const cache_view * v){
+	const cache_header * h = v->header;
+	uint64_t pos = 0;
+	uint64_t count = h->name_count + 2 * (uint64_t)h->var_count;
+	for(uint64_t i = 0; i < count; i++){
+		if(!skip_string(v, &pos)){
+			return false;
+		}
+	}
+	for(uint32_t i = 0; i < h->pattern_count; i++){
+		const cache_pattern * cp = &v->patterns[i];
+		const char * percent = pos < h->text_size ? strchr(v->text + pos, '%') : NULL;
+		if(!percent || strchr(percent + 1, '%') || cp->recipe_count == 0){
+			return false;
+		}
+		count = 1 + (uint64_t)cp->dep_count + cp->recipe_count;
+		for(uint64_t j = 0; j < count; j++){
+			if(!skip_string(v, &pos)){
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool mymake_load_cache(mymake_t * m, const char * path, const mymake_cache_key * key){
+	assert(m);
+	if(strtab_count(m->names) != 0){
+		// Only an empty mymake_t can be loaded into
+		return false;
+	}
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		return false;
+	}
+	struct stat statinfo;
+	if(fstat(fd, &statinfo) < 0 || statinfo.st_size < sizeof(cache_header)){
+		close(fd);
+		return false;
+	}
+	size_t size = statinfo.st_size;
+	void * map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		return false;
+	}
+
+	cache_view v;
+	size_t offsets[5];
+	v.header = map;
+	const cache_header * h = v.header;
+	if(memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+	   h->version != CACHE_VERSION ||
+	   memcmp(&h->key, key, sizeof(mymake_cache_key)) != 0 ||
+	   layout(h, offsets) != size){
+		munmap(map, size);
+		return false;
+	}
+	v.nodes = (const cache_node *)((const char *)map + offsets[0]);
+	v.edges = (const uint32_t *)((const char *)map + offsets[1]);
+	v.recipe_offsets = (const uint64_t *)((const char *)map + offsets[2]);
+	v.patterns = (const cache_pattern *)((const char *)map + offsets[3]);
+	v.text = (const char *)map + offsets[4];
+	if(!check_view(&v) || !check_strings(&v)){
+		munmap(map, size);
+		return false;
+	}
+
+	// Names first, so they get the same ids as before. A name that is there
+	// twice is the only thing not checked yet; m is put back as it was then.
+	uint64_t pos = 0;
+	for(uint32_t i = 0; i < h->name_count; i++){
+		const char * name = v.text + pos;
+		size_t length = strlen(name);
+		pos += length + 1;
+		if(mymake_name_id(m, name, length) != i){
+			fprintf(m->error, "Error: Graph cache %s is corrupt.\n", path);
+			strtab_destroy(m->names);
+			m->names = strtab_create();
+			munmap(map, size);
+			return false;
+		}
+	}
+
+	// Variable values are also used from the mapping
+	for(uint32_t i = 0; i < h->var_count; i++){
+		const char * name = v.text + pos;
+		size_t length = strlen(name);
+		pos += length + 1;
+		const char * value = v.text + pos;
+		pos += strlen(value) + 1;
+		mymake_define(m, name, length, value);
+	}
+
+	// So are the strings of pattern rules, which check_strings made sure
+	// can all be added
+	for(uint32_t i = 0; i < h->pattern_count; i++){
+		const cache_pattern * cp = &v.patterns[i];
+		uint64_t count = 1 + (uint64_t)cp->dep_count + cp->recipe_count;
+		const char ** strings = calloc(count, sizeof(char *));
+		for(uint64_t j = 0; j < count; j++){
+			strings[j] = v.text + pos;
+			pos += strlen(strings[j]) + 1;
+		}
+		bool added = mymake_add_pattern(m, strings[0], strings + 1, cp->dep_count,
+										strings + 1 + cp->dep_count, cp->recipe_count, false);
+		assert(added);
+		free(strings);
+	}
+
+	// Recipe lines are used straight from the mapping, which is kept
+	// until mymake_destroy
+	for(uint32_t i = 0; i < h->node_count; i++){
+		const cache_node * n = &v.nodes[i];
+		digraph_node_t * node = mymake_new_node(m, n->name_id, NULL, 0);
+		target * t = (target *)digraph_node_get_data(m->graph, node);
+		t->oneshell = (n->flags & NODE_ONESHELL) != 0;
+		t->rcount = n->recipe_count;
+		if(n->recipe_count > 0){
+			t->recipies = arena_alloc(m->arena, n->recipe_count * sizeof(char *));
+			for(uint32_t j = 0; j < n->recipe_count; j++){
+				t->recipies[j] = v.text + v.recipe_offsets[n->recipe_start + j];
+			}
+		}
+	}
+	for(uint32_t i = 0; i < h->node_count; i++){
+		const cache_node * n = &v.nodes[i];
+		digraph_node_t * from = digraph_node_from_id(m->graph, i);
+		for(uint32_t j = 0; j < n->edge_count; j++){
+			digraph_node_t * to = digraph_node_from_id(m->graph, v.edges[n->edge_start + j]);
+			if(to != from){
+				digraph_add_link(m->graph, from, to);
+			}
+		}
+	}
+	if(h->first_node != CACHE_NONE){
+		m->firstnode = digraph_node_from_id(m->graph, h->first_node);
+	}
+	m->oneshell_all = (h->flags & CACHE_ONESHELL_ALL) != 0;
+
+	m->cache_map = map;
+	m->cache_size = size;
+	return true;
+}
+
+// Writes count bytes, remembering if anything went wrong
+static void write_section(FILE * f, const void * data, size_t size, bool * ok){
+	if(size > 0 && fwrite(data, 1, size, f) != size){
+		*ok = false;
+	}
+}
+
+bool mymake_save_cache(mymake_t * m, const char * path, const mymake_cache_key * key){
+	assert(m);
+	digraph_t * g = m->graph;
+	cache_header h;
+	memset(&h, 0, sizeof(cache_header));
+	memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+	h.version = CACHE_VERSION;
+	h.key = *key;
+	h.name_count = strtab_count(m->names);
+	// The cache numbers the nodes from 0 up, leaving out the ids of
+	// destroyed nodes
+	uint32_t limit = digraph_node_id_limit(g);
+	digraph_node_t ** saved = calloc(limit + 1, sizeof(digraph_node_t *));
+	uint32_t * cache_id = calloc(limit + 1, sizeof(uint32_t));
+	h.node_count = 0;
+	for(uint32_t i = 0; i < limit; i++){
+		digraph_node_t * node = digraph_node_from_id(g, i);
+		if(node){
+			cache_id[i] = h.node_count;
+			saved[h.node_count] = node;
+			h.node_count++;
+		}
+	}
+	h.first_node = m->firstnode ? cache_id[digraph_node_id(g, m->firstnode)] : CACHE_NONE;
+	h.flags = m->oneshell_all ? CACHE_ONESHELL_ALL : 0;
+
+	// Lay out the nodes, their links and their recipe lines
+	cache_node * nodes = calloc(h.node_count + 1, sizeof(cache_node));
+	uint64_t edge_count = 0;
+	uint64_t recipe_count = 0;
+	for(uint32_t i = 0; i < h.node_count; i++){
+		digraph_node_t * node = saved[i];
+		target * t = (target *)digraph_node_get_data(g, node);
+		nodes[i].name_id = t->name_id;
+		nodes[i].flags = t->oneshell ? NODE_ONESHELL : 0;
+		nodes[i].edge_start = edge_count;
+		nodes[i].edge_count = digraph_node_outgoing_link_count(g, node);
+		nodes[i].recipe_start = recipe_count;
+		nodes[i].recipe_count = t->rcount;
+		edge_count += nodes[i].edge_count;
+		recipe_count += t->rcount;
+	}
+	if(edge_count >= UINT32_MAX || recipe_count >= UINT32_MAX){
+		free(nodes);
+		free(saved);
+		free(cache_id);
+		return false;
+	}
+	h.edge_count = edge_count;
+	h.recipe_count = recipe_count;
+
+	uint32_t * edges = calloc(pad8(edge_count * sizeof(uint32_t)) / sizeof(uint32_t) + 1,
+							  sizeof(uint32_t));
+	uint64_t * recipe_offsets = calloc(recipe_count + 1, sizeof(uint64_t));
+	uint64_t text_size = 0;
+	for(uint32_t i = 0; i < h.name_count; i++){
+		text_size += strlen(strtab_get(m->names, i)) + 1;
+	}
+	h.var_count = strtab_count(m->varnames);
+	for(uint32_t i = 0; i < h.var_count; i++){
+		text_size += strlen(strtab_get(m->varnames, i)) + 1;
+		text_size += strlen(m->vars[i].value) + 1;
+	}
+	h.pattern_count = m->pattern_count;
+	cache_pattern * patterns = calloc(h.pattern_count + 1, sizeof(cache_pattern));
+	for(uint32_t i = 0; i < h.pattern_count; i++){
+		const pattern_rule * rule = m->patterns[i];
+		patterns[i].dep_count = rule->dcount;
+		patterns[i].recipe_count = rule->rcount;
+		text_size += strlen(rule->pattern) + 1;
+		for(uint32_t j = 0; j < rule->dcount; j++){
+			text_size += strlen(rule->deps[j]) + 1;
+		}
+		for(uint32_t j = 0; j < rule->rcount; j++){
+			text_size += strlen(rule->recipies[j]) + 1;
+		}
+	}
+	digraph_node_t * nextnode = NULL;
+	for(uint32_t i = 0; i < h.node_count; i++){
+		digraph_node_t * node = saved[i];
+		target * t = (target *)digraph_node_get_data(g, node);
+		for(uint32_t j = 0; j < nodes[i].edge_count; j++){
+			digraph_node_get_link(g, node, j, &nextnode);
+			edges[nodes[i].edge_start + j] = cache_id[digraph_node_id(g, nextnode)];
+		}
+		for(uint32_t j = 0; j < t->rcount; j++){
+			recipe_offsets[nodes[i].recipe_start + j] = text_size;
+			text_size += strlen(t->recipies[j]) + 1;
+		}
+	}
+	// Keeps the text (and so the file) from being empty
+	text_size += 1;
+	h.text_size = text_size;
+
+	// Write to a temporary file first so a half-written cache is never seen
+	size_t length = strlen(path);
+	char * tmppath = calloc(length + 32, sizeof(char));
+	snprintf(tmppath, length + 32, "%s.%ld.tmp", path, (long)getpid());
+	FILE * f = fopen(tmppath, "wb");
+	bool ok = f != NULL;
+	if(f){
+		write_section(f, &h, sizeof(cache_header), &ok);
+		write_section(f, nodes, h.node_count * sizeof(cache_node), &ok);
+		write_section(f, edges, pad8(edge_count * sizeof(uint32_t)), &ok);
+		write_section(f, recipe_offsets, recipe_count * sizeof(uint64_t), &ok);
+		write_section(f, patterns, h.pattern_count * sizeof(cache_pattern), &ok);
+		for(uint32_t i = 0; i < h.name_count; i++){
+			const char * name = strtab_get(m->names, i);
+			write_section(f, name, strlen(name) + 1, &ok);
+		}
+		for(uint32_t i = 0; i < h.var_count; i++){
+			const char * name = strtab_get(m->varnames, i);
+			write_section(f, name, strlen(name) + 1, &ok);
+			write_section(f, m->vars[i].value, strlen(m->vars[i].value) + 1, &ok);
+		}
+		for(uint32_t i = 0; i < h.pattern_count; i++){
+			const pattern_rule * rule = m->patterns[i];
+			write_section(f, rule->pattern, strlen(rule->pattern) + 1, &ok);
+			for(uint32_t j = 0; j < rule->dcount; j++){
+				write_section(f, rule->deps[j], strlen(rule->deps[j]) + 1, &ok);
+			}
+			for(uint32_t j = 0; j < rule->rcount; j++){
+				write_section(f, rule->recipies[j], strlen(rule->recipies[j]) + 1, &ok);
+			}
+		}
+		for(uint32_t i = 0; i < h.node_count; i++){
+			target * t = (target *)digraph_node_get_data(g, saved[i]);
+			for(uint32_t j = 0; j < t->rcount; j++){
+				write_section(f, t->recipies[j], strlen(t->recipies[j]) + 1, &ok);
+			}
+		}
+		write_section(f, "", 1, &ok);
+		if(fclose(f) != 0){
+			ok = false;
+		}
+		if(ok && rename(tmppath, path) != 0){
+			ok = false;
+		}
+		if(!ok){
+			unlink(tmppath);
+		}
+	}
+
+	free(tmppath);
+	free(saved);
+	free(cache_id);
+	free(nodes);
+	free(edges);
+	free(recipe_offsets);
+	free(patterns);
+	return ok;
+}
+
+void mymake_close_cache(mymake_t * m){
+	if(m->cache_map){
+		munmap(m->cache_map, m->cache_size);
+		m->cache_map = NULL;
+		m->cache_size = 0;
+	}
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+/**
+ * Definitions shared by the files implementing mymake.h. Not part of the
+ * public interface.
+ */
+
+#include "mymake.h"
+#include "digraph.h"
+#include "arena.h"
+#include "strtab.h"
+#include "statedb.h"
+#include "trace.h"
+#include "capture.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+struct job;
+
+// Structure which will be hold in digraph_node_t as nodedata
+typedef struct target{
+	const char * name;   // Interned in mymake_t names
+	unsigned int name_id;
+	const char ** recipies;
+	unsigned int rcount;
+	struct job * job;    // Set while the target is part of a build plan
+	uint64_t mtime;      // Cached last_modification of the file
+	unsigned int mtime_epoch;  // Build in which mtime was read, 0 if unknown
+	unsigned int visit_epoch;  // Build in which the target was last visited
+	unsigned int dirty_epoch;  // Build in which it depended on a change
+	unsigned int checked_epoch;  // Last build that brought it up to date
+	unsigned int ran_epoch;      // Last build that ran its recipe, 0 if none
+	bool visit_result;         // What planning returned in visit_epoch
+	bool oneshell;             // Run the recipe in a single shell
+	bool pattern_checked;      // Pattern rules were tried for it
+	const char * stem;         // What % matched, if a pattern rule applied
+	const char * first_dep;    // First dependency of that pattern rule
+} target;
+
+// A rule whose target has a % in it, which matches any non-empty stem
+typedef struct pattern_rule{
+	const char * pattern;     // The target, e.g. %.o
+	size_t prefix_len;        // Characters before the %
+	size_t suffix_len;        // Characters after it
+	const char ** deps;       // A % in them stands for the stem
+	unsigned int dcount;
+	const char ** recipies;
+	unsigned int rcount;
+	unsigned int index;       // Position among all pattern rules
+	struct pattern_rule * next;   // Next rule with the same suffix
+} pattern_rule;
+
+// A variable from the makefile
+typedef struct variable{
+	const char * value;   // As defined; from the arena or the graph cache
+	char * expanded;      // Memoized expansion of value, NULL if not made yet
+	unsigned int expanded_gen;  // vargen when expanded was made
+	bool per_target;      // expanded used automatic variables, so isn't kept
+	bool expanding;       // Being expanded right now (to catch loops)
+} variable;
+
+// Growable NUL-terminated string
+typedef struct mymake_buf{
+	char * data;
+	size_t len;
+	size_t size;
+} mymake_buf;
+
+struct mymake_t{
+	FILE * output;
+	FILE * error;
+	digraph_t * graph;
+	digraph_node_t * firstnode;
+	bool acyclic;         // No links were added since cycles were last removed
+	strtab_t * names;     // Every target name, interned
+	digraph_node_t ** byname;   // Node of each name id, NULL if it has none
+	unsigned int bynamesize;
+	arena_t * arena;      // Memory of all targets
+	unsigned int jobs;    // Maximum number of recipes run at once
+	double max_load;      // Load average that holds back recipes, 0 if none
+	uint64_t min_memory;  // Bytes that must stay available, 0 if no limit
+	bool oneshell;        // Every recipe runs in a single shell
+	bool oneshell_all;    // Same, because the makefile asked for it
+	unsigned int epoch;   // Incremented by every mymake_build call
+	bool keep_mtimes;     // mtimes stay valid across builds (see mymake.h)
+	bool incremental;     // Only check what changed (see mymake.h)
+	bool dirty_only;      // The current build skips targets that aren't dirty
+	bool unresolved;      // The current build found a file it can't make
+	digraph_node_t ** touched;  // Files changed or rebuilt, oldest first
+	unsigned int * touched_epochs;  // Build during or after which each was
+	unsigned int touched_count;
+	unsigned int touched_size;
+	unsigned int touched_floor; // Older changes were forgotten
+	unsigned long stat_calls;   // Files stat()ed during the current build
+	unsigned long stat_saved;   // Lookups answered from the cache instead
+	statedb_t * db;       // Hashes and durations, NULL if not used
+	bool hashing;         // Skip recipes whose inputs are unchanged
+	trace_t * trace;      // Where timings go, NULL unless tracing
+	int output_sync;      // One of MYMAKE_OUTPUT_*
+	capture_t * capture;  // Output of running recipes, NULL if not captured
+	strtab_t * varnames;  // Name of every variable
+	variable * vars;      // Indexed by varnames id
+	unsigned int varsize;
+	unsigned int vargen;  // Incremented by every definition
+	mymake_buf linebuf;   // Holds the last line from mymake_expand_line
+	mymake_buf autobuf;   // Holds the value of $^
+	const target * expand_target;  // Target of the line being expanded
+	bool expand_auto;     // An automatic variable was expanded
+	pattern_rule ** patterns;   // Every pattern rule, in definition order
+	unsigned int pattern_count;
+	unsigned int patternsize;
+	strtab_t * suffixes;  // Suffix of every pattern rule target
+	pattern_rule ** bysuffix;   // Rules with each suffix id, latest first
+	unsigned int bysuffixsize;
+	size_t * suffix_lengths;    // Distinct suffix lengths
+	unsigned int nlengths;
+	void * cache_map;     // Graph cache the graph was loaded from, if any
+	size_t cache_size;
+};
+
+// Returns the id of the len characters at name in m->names, interning them
+// if necessary
+unsigned int mymake_name_id(mymake_t * m, const char * name, size_t len);
+
+// Creates the node for the target with the given name id, which must not
+// have one yet. The recipe lines are copied.
+digraph_node_t * mymake_new_node(mymake_t * m, unsigned int name_id,
+		const char ** recipe, unsigned int recipecount);
+
+// Sets the variable with the len characters at name as its name to value,
+// which isn't copied and must stay valid until mymake_destroy
+void mymake_define(mymake_t * m, const char * name, size_t len, const char * value);
+
+// Appends len characters at str to buf, keeping it NUL-terminated
+void mymake_buf_append(mymake_buf * buf, const char * str, size_t len);
+
+// Appends the expansion of text to buf: $(NAME) and ${NAME} are replaced by
+// the value of the variable (or environment variable) NAME, and $$ by $.
+// Returns false, after writing an error, if a reference is unterminated or
+// a variable refers to itself.
+bool mymake_expand(mymake_t * m, const char * text, mymake_buf * buf);
+
+// Returns line of the recipe of t with its variables expanded, including
+// the automatic variables $@ (t), $< (its first dependency), $^ (all of
+// them) and $* (the stem of its pattern rule). The result is either line
+// itself or m->linebuf, which the next call overwrites. Returns NULL on
+// error.
+const char * mymake_expand_line(mymake_t * m, const target * t, const char * line);
+
+// Frees every variable's memory that isn't in the arena
+void mymake_free_vars(mymake_t * m);
+
+// Adds a pattern rule. Its strings are copied if copy is set, otherwise they
+// must stay valid until mymake_destroy. Returns false if pattern has more
+// than one % or the rule has no recipe.
+bool mymake_add_pattern(mymake_t * m, const char * pattern, const char ** deps,
+		unsigned int dcount, const char ** recipe, unsigned int rcount, bool copy);
+
+// If t (the data of node) has no recipe, looks for the first pattern rule
+// matching its name whose dependencies all exist or have rules, and gives t
+// that rule's recipe and dependencies. Only done once per target.
+void mymake_match_pattern(mymake_t * m, digraph_node_t * node, target * t);
+
+// Returns the last modification time of the file for t. Each file is only
+// stat()ed once per mymake_build call (or at all, with keep_mtimes), unless
+// its recipe runs.
+uint64_t mymake_target_mtime(mymake_t * m, target * t);
+
+// Reads the mtime of every file reachable from goal that isn't known for
+// the current build yet, several at a time (see mymake_prefetch.c). Pattern
+// rules are applied to the targets on the way, so that the files they add
+// are read too. Does nothing for small graphs.
+void mymake_prefetch_mtimes(mymake_t * m, digraph_node_t * goal);
+
+// Creates a node for name if it has no rule but a pattern rule can build
+// it. Returns NULL if not.
+digraph_node_t * mymake_pattern_target(mymake_t * m, const char * name);
+
+// Frees the pattern rule index
+void mymake_free_patterns(mymake_t * m);
+
+// Releases the graph cache mapping, if m was loaded from one. Recipes may
+// point into it, so this is only done by mymake_destroy.
+void mymake_close_cache(mymake_t * m);
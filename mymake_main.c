@@ -1,13 +1,99 @@
 #define _XOPEN_SOURCE
 #include "mymake.h"
 #include "makefile_parser.h"
+#include "watch.h"
 #include <stdio.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
 #include <assert.h>
 
 //#define DEBUG
 
+// Appended to the makefile name to get the name of its graph cache
+#define CACHE_SUFFIX ".cache"
+// Appended to the makefile name to get the name of its state database
+#define STATEDB_SUFFIX ".state"
+
+// Values getopt_long returns for long options
+#define OPT_WATCH 256
+#define OPT_TRACE 257
+#define OPT_MIN_MEMORY 258
+
+// Settings from the command line
+typedef struct options{
+	const char * filename;
+	long jobs;
+	double max_load;
+	int output_sync;
+	uint64_t min_memory;
+	bool verbose;
+	bool dryrun;
+	bool use_cache;
+	bool use_hashes;
+	bool oneshell;
+	bool watch;
+	trace_t * trace;
+} options;
+
+// What changed while waiting in watch mode
+typedef struct changes{
+	mymake_t * m;
+	const char * filename;
+	bool makefile;      // The makefile itself changed
+	bool rebuild;       // A target or dependency changed
+	unsigned int builds;  // Builds whose own writes are still being reported
+} changes;
+
+// Returns a newly allocated copy of name with suffix appended
+static char * with_suffix(const char * name, const char * suffix){
+	char * path = calloc(strlen(name) + strlen(suffix) + 1, sizeof(char));
+	strcpy(path, name);
+	strcat(path, suffix);
+	return path;
+}
+
+// Reads a number of bytes, optionally followed by K, M or G. Returns false
+// if text isn't one.
+static bool parse_size(const char * text, uint64_t * bytes){
+	char * end = NULL;
+	errno = 0;
+	unsigned long long size = strtoull(text, &end, 10);
+	if(end == text || errno != 0 || *text == '-'){
+		return false;
+	}
+	int shift = 0;
+	switch(*end){
+	case 'k': case 'K': shift = 10; end++; break;
+	case 'm': case 'M': shift = 20; end++; break;
+	case 'g': case 'G': shift = 30; end++; break;
+	}
+	if(*end != '\0' || size > (UINT64_MAX >> shift)){
+		return false;
+	}
+	*bytes = (uint64_t)size << shift;
+	return true;
+}
+
+// Lets the parser hand names to mymake without copying them first
+const char * intern_name(void * userdata, const char * str, size_t len){
+	return mymake_intern((mymake_t *) userdata, str, len);
+}
+
+// Passes the targets of .ONESHELL rules on to mymake
+bool add_oneshell(void * userdata, const char ** targets, unsigned int tcount){
+	mymake_add_oneshell((mymake_t *) userdata, targets, tcount);
+	return true;
+}
+
+bool add_variable(void * userdata, unsigned int line, const char * varname,
+				  const char * value){
+	return mymake_add_variable((mymake_t *) userdata, varname, value);
+}
+
 bool build_graph(void * userdata,
 				 const char ** target, unsigned int tcount,
 				 const char ** dependencies, unsigned int dcount,
@@ -29,69 +115,296 @@ bool build_graph(void * userdata,
 
 }
 
+// Creates a mymake_t for the makefile. The graph comes from the graph cache
+// if it was made from this version of the makefile; otherwise the makefile
+// is parsed and a new cache written. Returns NULL on error.
+static mymake_t * load(const options * opts){
+	mymake_t * m = mymake_create(stdout, stderr);
+	mymake_set_jobs(m, opts->jobs);
+	mymake_set_throttle(m, opts->max_load, opts->min_memory);
+	mymake_set_output_sync(m, opts->output_sync);
+	mymake_set_oneshell(m, opts->oneshell);
+	mymake_set_trace(m, opts->trace);
+	mfp_cb_t parser;
+	parser.rule_cb = build_graph;
+	parser.variable_cb = add_variable;
+	parser.rule_slice_cb = NULL;
+	parser.intern = intern_name;
+	parser.oneshell_cb = add_oneshell;
+	parser.error = stderr;
+
+	char * cachefile = with_suffix(opts->filename, CACHE_SUFFIX);
+	mymake_cache_key key;
+	bool have_key = opts->use_cache && mymake_cache_key_for(opts->filename, &key);
+	if(!have_key || !mymake_load_cache(m, cachefile, &key)){
+		if(!(mfp_parse_path(opts->filename, &parser, m))){
+			free(cachefile);
+			mymake_destroy(m);
+			return NULL;
+		}
+		if(have_key){
+			// Not being able to write it only costs time on the next run
+			mymake_save_cache(m, cachefile, &key);
+		}
+	}
+	free(cachefile);
+
+	// Recipe durations only matter with several jobs
+	if(opts->use_hashes || opts->jobs > 1){
+		char * dbfile = with_suffix(opts->filename, STATEDB_SUFFIX);
+		bool loaded = mymake_use_state_db(m, dbfile, opts->use_hashes);
+		free(dbfile);
+		if(!loaded){
+			mymake_destroy(m);
+			return NULL;
+		}
+	}
+	return m;
+}
+
+// Builds the count targets, or the default target if there are none
+static void build_targets(mymake_t * m, const options * opts, char ** targets,
+						  int count){
+	if(count == 0){
+		mymake_build(m, NULL, opts->verbose, opts->dryrun);
+	} else {
+		for(int i = 0; i < count; i++){
+			mymake_build(m, targets[i], opts->verbose, opts->dryrun);
+		}
+	}
+}
+
+// Watches the directory the file name is in
+void watch_file_dir(void * userdata, const char * name){
+	watch_t * w = (watch_t *) userdata;
+	const char * slash = strrchr(name, '/');
+	if(!slash){
+		watch_add_dir(w, "");
+		return;
+	}
+	size_t len = slash == name ? 1 : slash - name;
+	char * dir = calloc(len + 1, sizeof(char));
+	memcpy(dir, name, len);
+	// The directory may not exist yet; nothing in it can be watched then
+	watch_add_dir(w, dir);
+	free(dir);
+}
+
+void note_change(void * userdata, const char * path){
+	changes * ch = (changes *) userdata;
+	if(strcmp(path, ch->filename) == 0){
+		ch->makefile = true;
+	} else if(mymake_touched(ch->m, path) &&
+			  !(ch->builds > 0 && mymake_recipe_ran(ch->m, path, ch->builds))){
+		ch->rebuild = true;
+	}
+}
+
+// Builds the targets, then rebuilds them whenever a file they depend on
+// changes, reloading m when the makefile changes. Only returns if watching
+// fails; m is destroyed by then.
+static int watch_loop(mymake_t * m, const options * opts, char ** targets,
+					  int count){
+	watch_t * w = watch_create();
+	if(!w){
+		fprintf(stderr, "Error: Unable to watch files for changes.\n");
+		mymake_destroy(m);
+		return EXIT_FAILURE;
+	}
+	watch_file_dir(w, opts->filename);
+	// Watched before the first build, so that what changes while it runs
+	// isn't missed
+	mymake_visit_sources(m, watch_file_dir, w);
+	build_targets(m, opts, targets, count);
+
+	changes ch;
+	ch.filename = opts->filename;
+	while(true){
+		// The build may have added sources (through pattern rules)
+		mymake_keep_mtimes(m, true);
+		mymake_set_incremental(m, true);
+		mymake_visit_sources(m, watch_file_dir, w);
+
+		// What the recipes that just ran wrote is only noted, it doesn't
+		// start another build; other files that changed meanwhile do
+		ch.m = m;
+		ch.makefile = false;
+		ch.rebuild = false;
+		ch.builds = count > 0 ? count : 1;
+		watch_drain(w, note_change, &ch);
+		ch.builds = 0;
+
+		printf("Watching for changes...\n");
+		fflush(stdout);
+		while(!ch.makefile && !ch.rebuild){
+			if(!watch_wait(w, note_change, &ch)){
+				fprintf(stderr, "Error: Unable to watch files for changes.\n");
+				watch_destroy(w);
+				mymake_destroy(m);
+				return EXIT_FAILURE;
+			}
+		}
+
+		if(ch.makefile){
+			mymake_t * fresh = load(opts);
+			if(fresh){
+				mymake_destroy(m);
+				m = fresh;
+			} else {
+				fprintf(stderr, "Keeping the previous version of %s.\n", opts->filename);
+			}
+		}
+		build_targets(m, opts, targets, count);
+	}
+}
+
 int main(int argc, char * argv[]){
 	int c;
-	bool verbose = false;
-	bool dryrun = false;
-	char * filename = "Makefile.mymake";    // Default value
+	options opts;
+	opts.filename = "Makefile.mymake";    // Default value
+	opts.jobs = 1;
+	opts.max_load = 0;
+	opts.output_sync = MYMAKE_OUTPUT_DIRECT;
+	opts.min_memory = 0;
+	opts.verbose = false;
+	opts.dryrun = false;
+	opts.use_cache = true;
+	opts.use_hashes = false;
+	opts.oneshell = false;
+	opts.watch = false;
+	opts.trace = NULL;
+	char * end = NULL;
 	int exit_stat = EXIT_SUCCESS;
 
-	while((c = getopt(argc, argv, ":hvnf:")) != -1){
+	static const struct option long_options[] = {
+		{"watch", no_argument, NULL, OPT_WATCH},
+		{"trace", required_argument, NULL, OPT_TRACE},
+		{"min-memory", required_argument, NULL, OPT_MIN_MEMORY},
+		{NULL, 0, NULL, 0}
+	};
+
+	while((c = getopt_long(argc, argv, ":hvnCHSf:j:l:O::", long_options, NULL)) != -1){
 		switch(c){
 		case 'h':
 			printf("\
-Usage: mymake [-f filename] [-v] [-n] targets...\n\n\
+Usage: mymake [-f filename] [-v] [-n] [-C] [-H] [-S] [-j jobs] [-l load]\n\
+              [-O[mode]] [--min-memory=size] [--watch] [--trace=file]\n\
+              targets...\n\n\
 \t-h\t\t print help\n\
 \t-v\t\t enable verbose mode\n\
 \t-n\t\t enable dryrun mode\n\
-\t-f filename\t one argument which is the makefile to read\n\n");
+\t-C\t\t don't read or write the graph cache (filename.cache)\n\
+\t-H\t\t skip recipes whose inputs' contents didn't change\n\
+\t\t\t (hashes are kept in filename.state)\n\
+\t-S\t\t run all lines of a recipe in a single shell\n\
+\t-f filename\t one argument which is the makefile to read\n\
+\t-j jobs\t\t number of recipes to run at the same time\n\
+\t\t\t (with more than 1, recipe durations are kept in\n\
+\t\t\t filename.state to start long chains first)\n\
+\t-l load\t\t don't start recipes while the load average is at\n\
+\t\t\t least load (one always runs)\n\
+\t-O[mode]\t keep the output of recipes run at the same time\n\
+\t\t\t apart. mode is job (the default) to write it when\n\
+\t\t\t the recipe is done, live to also show the oldest\n\
+\t\t\t recipe's output as it comes, or none\n\
+\t--min-memory=size don't start recipes while less than size bytes of\n\
+\t\t\t memory are available (K, M and G suffixes work)\n\
+\t--watch\t\t keep running, and build again when files change\n\
+\t--trace=file\t write how long each target took to file (Chrome\n\
+\t\t\t trace format) and list the slowest ones\n\n");
 			return EXIT_SUCCESS;
 		case 'v':
-			verbose = true;
+			opts.verbose = true;
 			break;
 		case 'n':
-			dryrun = true;
+			opts.dryrun = true;
+			break;
+		case 'C':
+			opts.use_cache = false;
+			break;
+		case 'H':
+			opts.use_hashes = true;
+			break;
+		case 'S':
+			opts.oneshell = true;
 			break;
 		case 'f':
-			filename = optarg;
+			opts.filename = optarg;
+			break;
+		case 'j':
+			opts.jobs = strtol(optarg, &end, 10);
+			if(*end != '\0' || opts.jobs < 1){
+				fprintf(stderr, "Invalid number of jobs %s.\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'l':
+			opts.max_load = strtod(optarg, &end);
+			if(end == optarg || *end != '\0' || !(opts.max_load > 0)){
+				fprintf(stderr, "Invalid load average %s.\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'O':
+			if(!optarg || strcmp(optarg, "job") == 0){
+				opts.output_sync = MYMAKE_OUTPUT_JOB;
+			} else if(strcmp(optarg, "live") == 0){
+				opts.output_sync = MYMAKE_OUTPUT_LIVE;
+			} else if(strcmp(optarg, "none") == 0){
+				opts.output_sync = MYMAKE_OUTPUT_DIRECT;
+			} else {
+				fprintf(stderr, "Invalid output mode %s.\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_MIN_MEMORY:
+			if(!parse_size(optarg, &opts.min_memory)){
+				fprintf(stderr, "Invalid memory size %s.\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_WATCH:
+			opts.watch = true;
+			break;
+		case OPT_TRACE:
+			if(opts.trace){
+				trace_close(opts.trace);
+			}
+			opts.trace = trace_open(optarg);
+			if(!opts.trace){
+				fprintf(stderr, "Unable to create trace file %s.\n", optarg);
+				return EXIT_FAILURE;
+			}
 			break;
 		case ':':
 			break;
 		case '?':
-			fprintf(stderr, "Unknown option -%c.\n", optopt);
+			if(optopt){
+				fprintf(stderr, "Unknown option -%c.\n", optopt);
+			} else {
+				fprintf(stderr, "Unknown option %s.\n", argv[optind - 1]);
+			}
 			return EXIT_FAILURE;
 			break;
 		}
 	}
 
-	FILE * f = fopen(filename, "r");
-	if(!f){
-		fprintf(stderr, "Error opening file.\n");
-		return EXIT_FAILURE;
-	}
-
-	mymake_t * m = mymake_create(stdout, stderr);
-	mfp_cb_t parser;
-	parser.rule_cb = build_graph;
-	parser.error = stderr;
-	if(!(mfp_parse(f, &parser, m))){
+	mymake_t * m = load(&opts);
+	if(!m){
 		exit_stat = EXIT_FAILURE;
 		goto end;
 	}
 
-	int target_count = argc - optind;
-	char * curtarget = NULL;
-	if(target_count == 0){
-		mymake_build(m, curtarget, verbose, dryrun);
+	if(opts.watch){
+		exit_stat = watch_loop(m, &opts, argv + optind, argc - optind);
 	} else {
-		for(int i = optind; i < argc; i++){
-			curtarget = argv[i];
-			mymake_build(m, curtarget, verbose, dryrun);
-		}
+		build_targets(m, &opts, argv + optind, argc - optind);
+		mymake_destroy(m);
 	}
 
 end:
-	if(m)mymake_destroy(m);
-	if(f)fclose(f);
+	if(opts.trace && !trace_close(opts.trace)){
+		fprintf(stderr, "Unable to write the trace file.\n");
+	}
 	return exit_stat;
 }
@@ -0,0 +1,224 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mymake_internal.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Initial sizes, will allocate more if needed
+#define INITPATTERNS 8
+
+/**
+ * Pattern rules are indexed on the part of their target after the %. A name
+ * is matched by looking up its last n characters for every distinct suffix
+ * length n, so only rules whose suffix fits are compared against it, no
+ * matter how many rules there are.
+ *
+ * Nothing is done for a target until the build reaches it without a recipe;
+ * then the links to the dependencies of the matching rule are added.
+ */
+
+bool mymake_add_pattern(mymake_t * m, const char * pattern, const char ** deps,
+						unsigned int dcount, const char ** recipe, unsigned int rcount,
+						bool copy){
+	const char * percent = strchr(pattern, '%');
+	assert(percent);
+	if(strchr(percent + 1, '%')){
+		fprintf(m->error, "Error: Pattern %s has more than one %%.\n", pattern);
+		return false;
+	}
+	if(rcount == 0){
+		fprintf(m->error, "Error: Pattern rule %s has no recipe.\n", pattern);
+		return false;
+	}
+
+	pattern_rule * rule = arena_alloc(m->arena, sizeof(pattern_rule));
+	rule->pattern = copy ? arena_strdup(m->arena, pattern) : pattern;
+	rule->prefix_len = percent - pattern;
+	rule->suffix_len = strlen(percent + 1);
+	rule->dcount = dcount;
+	rule->deps = arena_alloc(m->arena, (dcount + 1) * sizeof(char *));
+	for(int i = 0; i < dcount; i++){
+		rule->deps[i] = copy ? arena_strdup(m->arena, deps[i]) : deps[i];
+	}
+	rule->rcount = rcount;
+	rule->recipies = arena_alloc(m->arena, rcount * sizeof(char *));
+	for(int i = 0; i < rcount; i++){
+		rule->recipies[i] = copy ? arena_strdup(m->arena, recipe[i]) : recipe[i];
+	}
+
+	if(m->pattern_count == m->patternsize){
+		m->patternsize = m->patternsize ? m->patternsize * 2 : INITPATTERNS;
+		m->patterns = realloc(m->patterns, m->patternsize * sizeof(pattern_rule *));
+	}
+	rule->index = m->pattern_count;
+	m->patterns[m->pattern_count] = rule;
+	m->pattern_count++;
+
+	// Index it on its suffix
+	unsigned int id = strtab_intern(m->suffixes, percent + 1, rule->suffix_len);
+	if(id >= m->bysuffixsize){
+		unsigned int oldsize = m->bysuffixsize;
+		m->bysuffixsize = m->bysuffixsize ? m->bysuffixsize * 2 : INITPATTERNS;
+		while(id >= m->bysuffixsize){
+			m->bysuffixsize *= 2;
+		}
+		m->bysuffix = realloc(m->bysuffix, m->bysuffixsize * sizeof(pattern_rule *));
+		memset(m->bysuffix + oldsize, 0,
+			   (m->bysuffixsize - oldsize) * sizeof(pattern_rule *));
+	}
+	if(!m->bysuffix[id]){
+		// A suffix not seen before, perhaps of a new length
+		unsigned int i = 0;
+		while(i < m->nlengths && m->suffix_lengths[i] != rule->suffix_len){
+			i++;
+		}
+		if(i == m->nlengths){
+			m->suffix_lengths = realloc(m->suffix_lengths, (m->nlengths + 1) * sizeof(size_t));
+			m->suffix_lengths[m->nlengths] = rule->suffix_len;
+			m->nlengths++;
+		}
+	}
+	rule->next = m->bysuffix[id];
+	m->bysuffix[id] = rule;
+	return true;
+}
+
+// Sets buf to dep with its % (if any) replaced by the stem
+static void substitute(mymake_buf * buf, const char * dep, const char * stem,
+					   size_t stem_len){
+	buf->len = 0;
+	const char * percent = strchr(dep, '%');
+	if(!percent){
+		mymake_buf_append(buf, dep, strlen(dep));
+		return;
+	}
+	mymake_buf_append(buf, dep, percent - dep);
+	mymake_buf_append(buf, stem, stem_len);
+	mymake_buf_append(buf, percent + 1, strlen(percent + 1));
+}
+
+// Checks that every dependency of rule (for the given stem) has a rule or
+// is an existing file. Files that are targets go through their cached mtime;
+// others aren't in the graph, so have nowhere to keep it.
+static bool can_use(mymake_t * m, const pattern_rule * rule, const char * stem,
+					size_t stem_len, mymake_buf * buf){
+	for(int i = 0; i < rule->dcount; i++){
+		substitute(buf, rule->deps[i], stem, stem_len);
+		unsigned int id = strtab_find(m->names, buf->data, buf->len);
+		if(id != STRTAB_NONE && id < m->bynamesize && m->byname[id]){
+			target * t = (target *)digraph_node_get_data(m->graph, m->byname[id]);
+			if(t->rcount == 0 && mymake_target_mtime(m, t) == 0){
+				return false;
+			}
+		} else if(last_modification(buf->data) == 0){
+			return false;
+		}
+	}
+	return true;
+}
+
+// Returns the first defined pattern rule that can build name, NULL if none
+static pattern_rule * find_pattern(mymake_t * m, const char * name, mymake_buf * buf){
+	size_t len = strlen(name);
+	pattern_rule * best = NULL;
+	for(unsigned int i = 0; i < m->nlengths; i++){
+		size_t suffix_len = m->suffix_lengths[i];
+		if(suffix_len >= len){
+			continue;
+		}
+		unsigned int id = strtab_find(m->suffixes, name + len - suffix_len, suffix_len);
+		if(id == STRTAB_NONE){
+			continue;
+		}
+		for(pattern_rule * rule = m->bysuffix[id]; rule; rule = rule->next){
+			if(best && rule->index > best->index){
+				continue;
+			}
+			// The stem can't be empty
+			if(rule->prefix_len + suffix_len >= len ||
+			   memcmp(name, rule->pattern, rule->prefix_len) != 0){
+				continue;
+			}
+			if(can_use(m, rule, name + rule->prefix_len,
+					   len - rule->prefix_len - suffix_len, buf)){
+				best = rule;
+			}
+		}
+	}
+	return best;
+}
+
+void mymake_match_pattern(mymake_t * m, digraph_node_t * node, target * t){
+	if(t->pattern_checked || t->rcount > 0 || m->pattern_count == 0){
+		return;
+	}
+	t->pattern_checked = true;
+
+	mymake_buf buf = {NULL, 0, 0};
+	pattern_rule * rule = find_pattern(m, t->name, &buf);
+	if(!rule){
+		free(buf.data);
+		return;
+	}
+
+	size_t stem_len = strlen(t->name) - rule->prefix_len - rule->suffix_len;
+	char * stem = arena_alloc(m->arena, stem_len + 1);
+	memcpy(stem, t->name + rule->prefix_len, stem_len);
+	t->stem = stem;
+	t->recipies = rule->recipies;
+	t->rcount = rule->rcount;
+
+	// Link the dependencies, skipping ones the target already has
+	digraph_node_t * nextnode = NULL;
+	for(int i = 0; i < rule->dcount; i++){
+		substitute(&buf, rule->deps[i], stem, stem_len);
+		unsigned int id = mymake_name_id(m, buf.data, buf.len);
+		digraph_node_t * dep = m->byname[id];
+		if(!dep){
+			dep = mymake_new_node(m, id, NULL, 0);
+		}
+		unsigned int count = digraph_node_outgoing_link_count(m->graph, node);
+		bool linked = false;
+		for(int k = 0; k < count && !linked; k++){
+			digraph_node_get_link(m->graph, node, k, &nextnode);
+			linked = nextnode == dep;
+		}
+		if(dep == node){
+			fprintf(m->error, "Error: Circular dependency of %s on itself dropped.\n", t->name);
+		} else if(!linked){
+			digraph_add_link(m->graph, node, dep);
+			m->acyclic = false;
+		}
+		if(i == 0){
+			t->first_dep = strtab_get(m->names, id);
+		}
+	}
+	free(buf.data);
+}
+
+digraph_node_t * mymake_pattern_target(mymake_t * m, const char * name){
+	if(m->pattern_count == 0){
+		return NULL;
+	}
+	mymake_buf buf = {NULL, 0, 0};
+	pattern_rule * rule = find_pattern(m, name, &buf);
+	free(buf.data);
+	if(!rule){
+		return NULL;
+	}
+
+	unsigned int id = mymake_name_id(m, name, strlen(name));
+	digraph_node_t * node = mymake_new_node(m, id, NULL, 0);
+	mymake_match_pattern(m, node, (target *)digraph_node_get_data(m->graph, node));
+	return node;
+}
+
+void mymake_free_patterns(mymake_t * m){
+	// The rules themselves are in the arena
+	free(m->patterns);
+	free(m->bysuffix);
+	free(m->suffix_lengths);
+	strtab_destroy(m->suffixes);
+}
@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mymake_internal.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Graphs with fewer nodes than this are stat()ed as the build goes
+#define PREFETCH_MIN 512
+// Threads stat()ing files at the same time
+#define PREFETCH_THREADS 8
+// Most files handed to a thread at once
+#define PREFETCH_CHUNK 64
+
+/**
+ * Before the dependency walk of a large build, the mtime of every file it
+ * can reach is read by a few threads at once, so that on a slow or cold
+ * file system (NFS, for example) the walk doesn't wait for one stat() at a
+ * time. Files are grouped by directory and looked up with fstatat relative
+ * to a descriptor of their directory, which each thread keeps open while
+ * it works through that directory.
+ *
+ * Threads only write the mtime of the targets in their own chunks; the
+ * targets are marked as read for the build once all of them are done.
+ */
+
+// A file whose mtime is needed
+typedef struct prefetch_file{
+	target * t;
+	size_t dir_len;       // Length of the directory part of the name
+} prefetch_file;
+
+// A run of files in the same directory
+typedef struct prefetch_chunk{
+	unsigned int first;
+	unsigned int count;
+} prefetch_chunk;
+
+typedef struct prefetch_work{
+	prefetch_file * files;
+	prefetch_chunk * chunks;
+	unsigned int nchunks;
+	atomic_uint next;     // Next chunk to hand out
+} prefetch_work;
+
+// Orders files by directory, then by name
+static int by_directory(const void * a, const void * b){
+	const prefetch_file * fa = (const prefetch_file *) a;
+	const prefetch_file * fb = (const prefetch_file *) b;
+	size_t len = fa->dir_len < fb->dir_len ? fa->dir_len : fb->dir_len;
+	int cmp = memcmp(fa->t->name, fb->t->name, len);
+	if(cmp != 0){
+		return cmp;
+	}
+	if(fa->dir_len != fb->dir_len){
+		return fa->dir_len < fb->dir_len ? -1 : 1;
+	}
+	return strcmp(fa->t->name + fa->dir_len, fb->t->name + fb->dir_len);
+}
+
+static bool same_directory(const prefetch_file * a, const prefetch_file * b){
+	return a->dir_len == b->dir_len && memcmp(a->t->name, b->t->name, a->dir_len) == 0;
+}
+
+// Opens the directory of file, AT_FDCWD for the current one
+static int open_directory(const prefetch_file * file){
+	if(file->dir_len == 0){
+		return AT_FDCWD;
+	}
+	// The root directory keeps its slash
+	size_t len = file->dir_len > 1 ? file->dir_len - 1 : 1;
+	char * dir = malloc(len + 1);
+	memcpy(dir, file->t->name, len);
+	dir[len] = '\0';
+	int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(dir);
+	return fd;
+}
+
+static void * prefetch_thread(void * arg){
+	prefetch_work * work = (prefetch_work *) arg;
+	const prefetch_file * dirfile = NULL;   // A file in the open directory
+	int dirfd = AT_FDCWD;
+	while(true){
+		unsigned int c = atomic_fetch_add(&work->next, 1);
+		if(c >= work->nchunks){
+			break;
+		}
+		prefetch_chunk * chunk = &work->chunks[c];
+		prefetch_file * files = work->files + chunk->first;
+		if(!dirfile || !same_directory(dirfile, &files[0])){
+			if(dirfd >= 0) close(dirfd);
+			dirfd = open_directory(&files[0]);
+			dirfile = &files[0];
+		}
+		for(unsigned int i = 0; i < chunk->count; i++){
+			target * t = files[i].t;
+			if(dirfd == AT_FDCWD || dirfd >= 0){
+				t->mtime = last_modification_at(dirfd, t->name + files[i].dir_len);
+			} else {
+				// Can't open the directory (no permission to read it, or it
+				// doesn't exist); the full path gives the right answer
+				t->mtime = last_modification(t->name);
+			}
+		}
+	}
+	if(dirfd >= 0) close(dirfd);
+	return NULL;
+}
+
+// Called when collect first reaches node. A pattern rule may give it
+// dependencies, whose mtimes are needed as well.
+static bool expand_target(digraph_t * d, digraph_node_t * node, void * userdata){
+	mymake_match_pattern((mymake_t *) userdata, node,
+			(target *) digraph_node_get_data(d, node));
+	return true;
+}
+
+// Sets *files to every target reachable from goal whose mtime isn't known
+// yet. Returns how many there are.
+static unsigned int collect(mymake_t * m, digraph_node_t * goal, prefetch_file ** out){
+	uint32_t * order = NULL;
+	unsigned int reached = digraph_dependency_order(m->graph, &goal, 1, expand_target,
+													m, &order);
+	prefetch_file * files = malloc((reached + 1) * sizeof(prefetch_file));
+	*out = files;
+	unsigned int count = 0;
+	for(unsigned int i = 0; i < reached; i++){
+		target * t = (target *) digraph_node_get_data(m->graph,
+				digraph_node_from_id(m->graph, order[i]));
+		if(t->mtime_epoch != m->epoch && !(m->keep_mtimes && t->mtime_epoch != 0)){
+			const char * slash = strrchr(t->name, '/');
+			files[count].t = t;
+			files[count].dir_len = slash ? slash - t->name + 1 : 0;
+			count++;
+		}
+	}
+	free(order);
+	return count;
+}
+
+void mymake_prefetch_mtimes(mymake_t * m, digraph_node_t * goal){
+	unsigned int nodes = digraph_node_count(m->graph);
+	if(nodes < PREFETCH_MIN){
+		return;
+	}
+	prefetch_file * files = NULL;
+	unsigned int count = collect(m, goal, &files);
+	if(count < PREFETCH_MIN){
+		free(files);
+		return;
+	}
+	qsort(files, count, sizeof(prefetch_file), by_directory);
+
+	prefetch_work work;
+	work.files = files;
+	work.chunks = malloc(count * sizeof(prefetch_chunk));
+	work.nchunks = 0;
+	atomic_init(&work.next, 0);
+	for(unsigned int i = 0; i < count; ){
+		unsigned int end = i + 1;
+		while(end < count && end - i < PREFETCH_CHUNK && same_directory(&files[i], &files[end])){
+			end++;
+		}
+		work.chunks[work.nchunks].first = i;
+		work.chunks[work.nchunks].count = end - i;
+		work.nchunks++;
+		i = end;
+	}
+
+	pthread_t threads[PREFETCH_THREADS];
+	unsigned int started = 0;
+	while(started < PREFETCH_THREADS && started < work.nchunks &&
+		  pthread_create(&threads[started], NULL, prefetch_thread, &work) == 0){
+		started++;
+	}
+	// If no thread could be made, this one does all the work
+	if(started == 0){
+		prefetch_thread(&work);
+	}
+	for(unsigned int i = 0; i < started; i++){
+		pthread_join(threads[i], NULL);
+	}
+
+	for(unsigned int i = 0; i < count; i++){
+		files[i].t->mtime_epoch = m->epoch;
+	}
+	m->stat_calls += count;
+	free(work.chunks);
+	free(files);
+}
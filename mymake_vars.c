@@ -0,0 +1,243 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mymake_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Initial sizes, will allocate more if needed
+#define INITVARS 16
+#define INITBUF 256
+
+// Names of the automatic variables
+#define AUTOMATIC_VARS "@<^*"
+
+/**
+ * Variables are stored as they were defined and expanded lazily, the first
+ * time a recipe line refers to them. The expansion is memoized until the
+ * next definition (of any variable, as any of them could be referenced).
+ * Values that use automatic variables depend on the target being built, so
+ * those are expanded again every time.
+ */
+
+void mymake_buf_append(mymake_buf * buf, const char * str, size_t len){
+	if(buf->len + len + 1 > buf->size){
+		if(buf->size == 0) buf->size = INITBUF;
+		while(buf->len + len + 1 > buf->size){
+			buf->size *= 2;
+		}
+		buf->data = realloc(buf->data, buf->size);
+	}
+	memcpy(buf->data + buf->len, str, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+}
+
+bool mymake_supports_variables(){
+	return true;
+}
+
+void mymake_define(mymake_t * m, const char * name, size_t len, const char * value){
+	unsigned int id = strtab_intern(m->varnames, name, len);
+	if(id >= m->varsize){
+		unsigned int oldsize = m->varsize;
+		m->varsize = m->varsize ? m->varsize * 2 : INITVARS;
+		while(id >= m->varsize){
+			m->varsize *= 2;
+		}
+		m->vars = realloc(m->vars, m->varsize * sizeof(variable));
+		memset(m->vars + oldsize, 0, (m->varsize - oldsize) * sizeof(variable));
+	}
+	m->vars[id].value = value;
+	m->vargen++;
+}
+
+bool mymake_add_variable(mymake_t * m, const char * varname, const char * val){
+	assert(m);
+	assert(varname);
+	assert(val);
+	mymake_define(m, varname, strlen(varname), arena_strdup(m->arena, val));
+	return true;
+}
+
+// Returns the value of the automatic variable name for m->expand_target
+static const char * automatic_value(mymake_t * m, char name){
+	const target * t = m->expand_target;
+	m->expand_auto = true;
+	if(name == '@'){
+		return t->name;
+	}
+	if(name == '*'){
+		return t->stem ? t->stem : "";
+	}
+	if(name == '<' && t->first_dep){
+		return t->first_dep;
+	}
+
+	digraph_node_t * node = m->byname[t->name_id];
+	unsigned int num_deps = digraph_node_outgoing_link_count(m->graph, node);
+	digraph_node_t * nextnode = NULL;
+	m->autobuf.len = 0;
+	mymake_buf_append(&m->autobuf, "", 0);
+	for(int i = 0; i < num_deps; i++){
+		digraph_node_get_link(m->graph, node, i, &nextnode);
+		target * dep = (target *)digraph_node_get_data(m->graph, nextnode);
+		if(name == '<'){
+			return dep->name;
+		}
+		if(i > 0) mymake_buf_append(&m->autobuf, " ", 1);
+		mymake_buf_append(&m->autobuf, dep->name, strlen(dep->name));
+	}
+	return m->autobuf.data;
+}
+
+// Returns the expanded value of the variable with the len characters at
+// name as its name: from the makefile if it's defined there, otherwise from
+// the environment, otherwise "". Returns NULL on error.
+static const char * variable_value(mymake_t * m, const char * name, size_t len){
+	if(len == 1 && m->expand_target && strchr(AUTOMATIC_VARS, name[0])){
+		return automatic_value(m, name[0]);
+	}
+
+	unsigned int id = strtab_find(m->varnames, name, len);
+	if(id == STRTAB_NONE){
+		char * copy = calloc(len + 1, sizeof(char));
+		memcpy(copy, name, len);
+		const char * value = getenv(copy);
+		free(copy);
+		return value ? value : "";
+	}
+
+	variable * var = &m->vars[id];
+	if(var->expanded && var->expanded_gen == m->vargen && !var->per_target){
+		return var->expanded;
+	}
+	if(var->expanding){
+		fprintf(m->error, "Error: Variable %s references itself.\n",
+				strtab_get(m->varnames, id));
+		return NULL;
+	}
+
+	bool outer_auto = m->expand_auto;
+	m->expand_auto = false;
+	var->expanding = true;
+	mymake_buf buf = {NULL, 0, 0};
+	mymake_buf_append(&buf, "", 0);
+	bool ok = mymake_expand(m, var->value, &buf);
+	var->expanding = false;
+	bool per_target = m->expand_auto;
+	m->expand_auto = outer_auto || per_target;
+	if(!ok){
+		free(buf.data);
+		return NULL;
+	}
+
+	// m->vars may have moved, but defining variables while expanding
+	// isn't possible
+	free(var->expanded);
+	var->expanded = buf.data;
+	var->expanded_gen = m->vargen;
+	var->per_target = per_target;
+	return var->expanded;
+}
+
+// Returns the position of the bracket closing the reference whose name
+// starts at text, or NULL if there is none. Nested references are skipped.
+static const char * reference_end(const char * text, char open, char close){
+	unsigned int depth = 0;
+	for(const char * walker = text; *walker; walker++){
+		if(*walker == open){
+			depth++;
+		} else if(*walker == close){
+			if(depth == 0){
+				return walker;
+			}
+			depth--;
+		}
+	}
+	return NULL;
+}
+
+bool mymake_expand(mymake_t * m, const char * text, mymake_buf * buf){
+	const char * walker = text;
+	while(true){
+		const char * dollar = strchr(walker, '$');
+		if(!dollar){
+			mymake_buf_append(buf, walker, strlen(walker));
+			return true;
+		}
+		mymake_buf_append(buf, walker, dollar - walker);
+
+		char open = dollar[1];
+		if(open == '$'){
+			mymake_buf_append(buf, "$", 1);
+			walker = dollar + 2;
+			continue;
+		}
+		if(open != '\0' && strchr(AUTOMATIC_VARS, open)){
+			const char * value = variable_value(m, dollar + 1, 1);
+			if(!value){
+				return false;
+			}
+			mymake_buf_append(buf, value, strlen(value));
+			walker = dollar + 2;
+			continue;
+		}
+		if(open != '(' && open != '{'){
+			// Not a reference, leave it to the shell
+			mymake_buf_append(buf, "$", 1);
+			walker = dollar + 1;
+			continue;
+		}
+
+		const char * name = dollar + 2;
+		const char * end = reference_end(name, open, open == '(' ? ')' : '}');
+		if(!end){
+			fprintf(m->error, "Error: Unterminated variable reference in %s.\n", text);
+			return false;
+		}
+
+		// The name itself may contain references
+		const char * value = NULL;
+		if(memchr(name, '$', end - name)){
+			mymake_buf namebuf = {NULL, 0, 0};
+			char * raw = calloc(end - name + 1, sizeof(char));
+			memcpy(raw, name, end - name);
+			mymake_buf_append(&namebuf, "", 0);
+			if(mymake_expand(m, raw, &namebuf)){
+				value = variable_value(m, namebuf.data, namebuf.len);
+			}
+			free(raw);
+			free(namebuf.data);
+		} else {
+			value = variable_value(m, name, end - name);
+		}
+		if(!value){
+			return false;
+		}
+		mymake_buf_append(buf, value, strlen(value));
+		walker = end + 1;
+	}
+}
+
+const char * mymake_expand_line(mymake_t * m, const target * t, const char * line){
+	if(!strchr(line, '$')){
+		return line;
+	}
+	m->linebuf.len = 0;
+	mymake_buf_append(&m->linebuf, "", 0);
+	m->expand_target = t;
+	bool ok = mymake_expand(m, line, &m->linebuf);
+	m->expand_target = NULL;
+	return ok ? m->linebuf.data : NULL;
+}
+
+void mymake_free_vars(mymake_t * m){
+	for(unsigned int i = 0; i < strtab_count(m->varnames); i++){
+		free(m->vars[i].expanded);
+	}
+	free(m->vars);
+	free(m->linebuf.data);
+	free(m->autobuf.data);
+	strtab_destroy(m->varnames);
+}
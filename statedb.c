@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200809L
+#include "statedb.h"
+#include "strtab.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+
+// Size for calloc
+#define CSIZE 1
+// Initial number of records, will allocate more if necessary
+#define INITRECORDS 64
+
+// Everything known about one name. Records are indexed by the name's id in
+// the database's own string table.
+typedef struct record{
+	uint64_t mtime;         // mtime the hash was taken at
+	uint64_t hash;
+	uint64_t signature;
+	uint64_t duration;      // Microseconds its recipe took last time
+	bool has_hash;
+	bool has_signature;
+	bool has_duration;
+} record;
+
+struct statedb_t{
+	char * path;
+	strtab_t * names;
+	record * records;
+	unsigned int maxsize;
+	bool modified;
+};
+
+// Returns the record for name, creating an empty one if there is none
+static record * get_record(statedb_t * db, const char * name){
+	unsigned int id = strtab_intern(db->names, name, strlen(name));
+	if(id >= db->maxsize){
+		unsigned int oldsize = db->maxsize;
+		while(id >= db->maxsize){
+			db->maxsize *= 2;
+		}
+		db->records = realloc(db->records, db->maxsize * sizeof(record));
+		memset(db->records + oldsize, 0, (db->maxsize - oldsize) * sizeof(record));
+	}
+	return &db->records[id];
+}
+
+// Returns the record for name, NULL if there is none
+static record * find_record(statedb_t * db, const char * name){
+	unsigned int id = strtab_find(db->names, name, strlen(name));
+	if(id == STRTAB_NONE){
+		return NULL;
+	}
+	return &db->records[id];
+}
+
+statedb_t * statedb_load(const char * path){
+	assert(path);
+	FILE * f = fopen(path, "r");
+	if(!f && errno != ENOENT){
+		return NULL;
+	}
+
+	statedb_t * db = calloc(CSIZE, sizeof(statedb_t));
+	db->path = calloc(strlen(path) + 1, sizeof(char));
+	strcpy(db->path, path);
+	db->names = strtab_create();
+	db->maxsize = INITRECORDS;
+	db->records = calloc(db->maxsize, sizeof(record));
+	db->modified = false;
+	if(!f){
+		return db;
+	}
+
+	// Lines that don't parse are skipped; they'll be rewritten on save
+	char * line = NULL;
+	size_t len = 0;
+	while(getline(&line, &len, f) != -1){
+		uint64_t a, b;
+		int name_start = 0;
+		line[strcspn(line, "\n")] = '\0';
+		if(sscanf(line, "F %" SCNx64 " %" SCNx64 " %n", &a, &b, &name_start) == 2 &&
+		   name_start > 0 && line[name_start] != '\0'){
+			record * r = get_record(db, line + name_start);
+			r->mtime = a;
+			r->hash = b;
+			r->has_hash = true;
+		} else if(sscanf(line, "S %" SCNx64 " %n", &a, &name_start) == 1 &&
+				  name_start > 0 && line[name_start] != '\0'){
+			record * r = get_record(db, line + name_start);
+			r->signature = a;
+			r->has_signature = true;
+		} else if(sscanf(line, "D %" SCNx64 " %n", &a, &name_start) == 1 &&
+				  name_start > 0 && line[name_start] != '\0'){
+			record * r = get_record(db, line + name_start);
+			r->duration = a;
+			r->has_duration = true;
+		}
+	}
+	free(line);
+	fclose(f);
+	return db;
+}
+
+bool statedb_save(statedb_t * db){
+	assert(db);
+	if(!db->modified){
+		return true;
+	}
+
+	// Write to a temporary file first so a half-written database is never seen
+	size_t length = strlen(db->path);
+	char * tmppath = calloc(length + 32, sizeof(char));
+	snprintf(tmppath, length + 32, "%s.%ld.tmp", db->path, (long)getpid());
+	FILE * f = fopen(tmppath, "w");
+	if(!f){
+		free(tmppath);
+		return false;
+	}
+
+	bool ok = true;
+	unsigned int count = strtab_count(db->names);
+	for(unsigned int i = 0; i < count && ok; i++){
+		const record * r = &db->records[i];
+		const char * name = strtab_get(db->names, i);
+		if(r->has_hash && fprintf(f, "F %" PRIx64 " %" PRIx64 " %s\n", r->mtime, r->hash, name) < 0){
+			ok = false;
+		}
+		if(r->has_signature && fprintf(f, "S %" PRIx64 " %s\n", r->signature, name) < 0){
+			ok = false;
+		}
+		if(r->has_duration && fprintf(f, "D %" PRIx64 " %s\n", r->duration, name) < 0){
+			ok = false;
+		}
+	}
+	if(fclose(f) != 0){
+		ok = false;
+	}
+	if(ok && rename(tmppath, db->path) != 0){
+		ok = false;
+	}
+	if(!ok){
+		unlink(tmppath);
+	} else {
+		db->modified = false;
+	}
+	free(tmppath);
+	return ok;
+}
+
+void statedb_destroy(statedb_t * db){
+	assert(db);
+	strtab_destroy(db->names);
+	free(db->records);
+	free(db->path);
+	free(db);
+}
+
+bool statedb_file_hash(statedb_t * db, const char * name, uint64_t mtime,
+					   uint64_t * hash){
+	record * r = get_record(db, name);
+	if(r->has_hash && r->mtime == mtime){
+		*hash = r->hash;
+		return true;
+	}
+	if(!content_hash(name, hash)){
+		return false;
+	}
+	r->mtime = mtime;
+	r->hash = *hash;
+	r->has_hash = true;
+	db->modified = true;
+	return true;
+}
+
+bool statedb_get_signature(statedb_t * db, const char * name, uint64_t * sig){
+	record * r = find_record(db, name);
+	if(!r || !r->has_signature){
+		return false;
+	}
+	*sig = r->signature;
+	return true;
+}
+
+void statedb_set_signature(statedb_t * db, const char * name, uint64_t sig){
+	record * r = get_record(db, name);
+	if(r->has_signature && r->signature == sig){
+		return;
+	}
+	r->signature = sig;
+	r->has_signature = true;
+	db->modified = true;
+}
+
+bool statedb_get_duration(statedb_t * db, const char * name, uint64_t * us){
+	record * r = find_record(db, name);
+	if(!r || !r->has_duration){
+		return false;
+	}
+	*us = r->duration;
+	return true;
+}
+
+void statedb_set_duration(statedb_t * db, const char * name, uint64_t us){
+	record * r = get_record(db, name);
+	if(r->has_duration && r->duration == us){
+		return;
+	}
+	r->duration = us;
+	r->has_duration = true;
+	db->modified = true;
+}
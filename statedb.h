@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Small on-disk database of what mymake knew about files after the last
+ * build: the content hash of each file (with the mtime it was taken at) and,
+ * for each target, a signature of the inputs its recipe last ran with and
+ * how long the recipe took.
+ *
+ * The file is plain text, one record per line:
+ *
+ *   F <mtime> <hash> <name>
+ *   S <signature> <name>
+ *   D <microseconds> <name>
+ *
+ * with numbers in hexadecimal.
+ */
+
+struct statedb_t;
+typedef struct statedb_t statedb_t;
+
+// Loads the database at path. A missing file gives an empty database;
+// returns NULL only if the file exists but can't be read.
+statedb_t * statedb_load(const char * path);
+
+// Writes the database back to the path it was loaded from, if anything
+// changed. Returns false if it couldn't be written.
+bool statedb_save(statedb_t * db);
+
+void statedb_destroy(statedb_t * db);
+
+// Returns the content hash of the named file, whose modification time is
+// mtime. The file is only read if it has no hash recorded for that mtime.
+// Returns false if the file can't be read.
+bool statedb_file_hash(statedb_t * db, const char * name, uint64_t mtime,
+        uint64_t * hash);
+
+// Gets the input signature recorded for a target. Returns false if there
+// is none.
+bool statedb_get_signature(statedb_t * db, const char * name, uint64_t * sig);
+
+// Records the input signature for a target
+void statedb_set_signature(statedb_t * db, const char * name, uint64_t sig);
+
+// Gets how long the recipe of a target took the last time it ran, in
+// microseconds. Returns false if that isn't known.
+bool statedb_get_duration(statedb_t * db, const char * name, uint64_t * us);
+
+// Records how long the recipe of a target took
+void statedb_set_duration(statedb_t * db, const char * name, uint64_t us);
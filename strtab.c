@@ -0,0 +1,148 @@
+#include "strtab.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+// Size for calloc
+#define CSIZE 1
+// Initial number of slots, always a power of two
+#define INITSLOTS 64
+// Initial size of the id -> string array, will allocate more if necessary
+#define INITSTRINGS 64
+// Strings are stored in arena blocks of this many bytes
+#define STRING_BLOCKSIZE (256 * 1024)
+
+// A slot of the open-addressing table. id is STRTAB_NONE for empty slots.
+typedef struct slot{
+	uint32_t hash;
+	unsigned int id;
+} slot;
+
+struct strtab_t{
+	slot * slots;
+	unsigned int capacity;      // Number of slots
+	const char ** strings;      // Interned strings by id
+	size_t * lengths;           // Length of each string by id
+	unsigned int count;
+	unsigned int maxsize;       // Allocated size of strings and lengths
+	arena_t * arena;
+};
+
+// FNV-1a hash of len characters
+static uint32_t hash_string(const char * str, size_t len){
+	uint32_t h = 2166136261u;
+	for(size_t i = 0; i < len; i++){
+		h ^= (unsigned char)str[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static slot * new_slots(unsigned int capacity){
+	slot * slots = malloc(capacity * sizeof(slot));
+	for(int i = 0; i < capacity; i++){
+		slots[i].id = STRTAB_NONE;
+	}
+	return slots;
+}
+
+// Returns the slot holding the string, or the empty slot where it would go
+static slot * probe(const strtab_t * t, const char * str, size_t len, uint32_t hash){
+	unsigned int mask = t->capacity - 1;
+	unsigned int i = hash & mask;
+	while(t->slots[i].id != STRTAB_NONE){
+		unsigned int id = t->slots[i].id;
+		if(t->slots[i].hash == hash && t->lengths[id] == len &&
+		   memcmp(t->strings[id], str, len) == 0){
+			return &t->slots[i];
+		}
+		i = (i + 1) & mask;
+	}
+	return &t->slots[i];
+}
+
+// Double the number of slots and rehash every string
+static void grow_slots(strtab_t * t){
+	slot * old = t->slots;
+	unsigned int oldcapacity = t->capacity;
+	t->capacity *= 2;
+	t->slots = new_slots(t->capacity);
+	unsigned int mask = t->capacity - 1;
+	for(int i = 0; i < oldcapacity; i++){
+		if(old[i].id == STRTAB_NONE) continue;
+		unsigned int j = old[i].hash & mask;
+		while(t->slots[j].id != STRTAB_NONE){
+			j = (j + 1) & mask;
+		}
+		t->slots[j] = old[i];
+	}
+	free(old);
+}
+
+strtab_t * strtab_create(void){
+	strtab_t * t = calloc(CSIZE, sizeof(strtab_t));
+	t->capacity = INITSLOTS;
+	t->slots = new_slots(t->capacity);
+	t->maxsize = INITSTRINGS;
+	t->strings = calloc(t->maxsize, sizeof(char *));
+	t->lengths = calloc(t->maxsize, sizeof(size_t));
+	t->count = 0;
+	t->arena = arena_create(STRING_BLOCKSIZE);
+	return t;
+}
+
+void strtab_destroy(strtab_t * t){
+	assert(t);
+	arena_destroy(t->arena);
+	free(t->slots);
+	free(t->strings);
+	free(t->lengths);
+	free(t);
+}
+
+unsigned int strtab_intern(strtab_t * t, const char * str, size_t len){
+	assert(t);
+	uint32_t hash = hash_string(str, len);
+	slot * s = probe(t, str, len, hash);
+	if(s->id != STRTAB_NONE){
+		return s->id;
+	}
+
+	// Keep the load factor below 3/4
+	if((t->count + 1) * 4 > t->capacity * 3){
+		grow_slots(t);
+		s = probe(t, str, len, hash);
+	}
+	if(t->count == t->maxsize){
+		t->maxsize *= 2;
+		t->strings = realloc(t->strings, t->maxsize * sizeof(char *));
+		t->lengths = realloc(t->lengths, t->maxsize * sizeof(size_t));
+	}
+	assert(t->count < STRTAB_NONE);
+
+	// Arena memory is zeroed, which terminates the copy
+	char * copy = arena_alloc(t->arena, len + 1);
+	memcpy(copy, str, len);
+	t->strings[t->count] = copy;
+	t->lengths[t->count] = len;
+	s->hash = hash;
+	s->id = t->count;
+	t->count++;
+	return s->id;
+}
+
+unsigned int strtab_find(const strtab_t * t, const char * str, size_t len){
+	assert(t);
+	return probe(t, str, len, hash_string(str, len))->id;
+}
+
+const char * strtab_get(const strtab_t * t, unsigned int id){
+	assert(id < t->count);
+	return t->strings[id];
+}
+
+unsigned int strtab_count(const strtab_t * t){
+	return t->count;
+}
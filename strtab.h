@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * String interning table. Every distinct string is stored once and gets a
+ * dense id (0, 1, 2, ... in the order strings were added). The pointer
+ * returned for a string stays valid until the table is destroyed, so two
+ * interned strings are equal exactly when their ids (or pointers) are.
+ */
+
+struct strtab_t;
+typedef struct strtab_t strtab_t;
+
+// Returned by strtab_find if the string isn't in the table
+#define STRTAB_NONE ((unsigned int)-1)
+
+strtab_t * strtab_create(void);
+
+// Frees the table and every string in it
+void strtab_destroy(strtab_t * t);
+
+// Returns the id of the len characters at str, adding a copy of them to the
+// table if they aren't there yet. str does not need to be NUL-terminated.
+unsigned int strtab_intern(strtab_t * t, const char * str, size_t len);
+
+// Returns the id of the len characters at str, or STRTAB_NONE if they were
+// never interned
+unsigned int strtab_find(const strtab_t * t, const char * str, size_t len);
+
+// Returns the NUL-terminated string with the given id
+const char * strtab_get(const strtab_t * t, unsigned int id);
+
+// Returns how many strings are in the table
+unsigned int strtab_count(const strtab_t * t);
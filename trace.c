@@ -0,0 +1,71 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define CSIZE 1
+
+struct trace_t{
+	FILE * file;
+	long pid;            // Our own pid, used as the pid of every event
+	bool first;          // No event written yet
+};
+
+trace_t * trace_open(const char * path){
+	FILE * f = fopen(path, "w");
+	if(!f){
+		return NULL;
+	}
+	trace_t * t = calloc(CSIZE, sizeof(trace_t));
+	t->file = f;
+	t->pid = (long)getpid();
+	t->first = true;
+	fprintf(f, "[\n");
+	return t;
+}
+
+// Writes str as the contents of a JSON string
+static void write_escaped(FILE * f, const char * str){
+	for(const char * walker = str; *walker; walker++){
+		unsigned char c = (unsigned char)*walker;
+		if(c == '"' || c == '\\'){
+			fprintf(f, "\\%c", c);
+		} else if(c < 0x20){
+			fprintf(f, "\\u%04x", c);
+		} else {
+			fputc(c, f);
+		}
+	}
+}
+
+void trace_event(trace_t * t, const char * name, const char * category,
+				 uint64_t start_us, uint64_t dur_us, unsigned int tid, long pid){
+	assert(t);
+	FILE * f = t->file;
+	fprintf(f, "%s{\"name\":\"", t->first ? "" : ",\n");
+	t->first = false;
+	write_escaped(f, name);
+	fprintf(f, "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,"
+			"\"pid\":%ld,\"tid\":%u", category, (unsigned long long)start_us,
+			(unsigned long long)dur_us, t->pid, tid);
+	if(pid != 0){
+		fprintf(f, ",\"args\":{\"pid\":%ld}", pid);
+	}
+	fprintf(f, "}");
+}
+
+void trace_flush(trace_t * t){
+	fflush(t->file);
+}
+
+bool trace_close(trace_t * t){
+	fprintf(t->file, "\n]\n");
+	bool ok = !ferror(t->file);
+	if(fclose(t->file) != 0){
+		ok = false;
+	}
+	free(t);
+	return ok;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Writes timing events in the Chrome trace event format (JSON array form),
+ * which chrome://tracing and Perfetto can display. Events are written as
+ * they are recorded; the array is closed by trace_close, but viewers also
+ * accept a file whose writer was killed before that.
+ */
+
+struct trace_t;
+typedef struct trace_t trace_t;
+
+// Creates (or truncates) the trace file at path. Returns NULL on error.
+trace_t * trace_open(const char * path);
+
+// Records an event called name in the given category that started at
+// start_us (microseconds, see monotonic_us) and lasted dur_us. Events with
+// the same tid are shown on the same row. pid, if not 0, is recorded as the
+// process the event was about.
+void trace_event(trace_t * t, const char * name, const char * category,
+		uint64_t start_us, uint64_t dur_us, unsigned int tid, long pid);
+
+// Makes sure everything recorded so far is in the file
+void trace_flush(trace_t * t);
+
+// Closes the array and the file. Returns false if writing failed at some
+// point.
+bool trace_close(trace_t * t);
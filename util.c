@@ -5,13 +5,51 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <spawn.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern char ** environ;
+
+// XXH64 constants
+#define PRIME64_1 11400714785074694791ULL
+#define PRIME64_2 14029467366897019727ULL
+#define PRIME64_3 1609587929392839161ULL
+#define PRIME64_4 9650029242287828579ULL
+#define PRIME64_5 2870177450012600261ULL
+
+// Size of the buffer files are read through when hashing them
+#define HASH_BUFSIZE (256 * 1024)
+
+// Where the cgroup memory controllers are mounted
+#define CGROUP2_ROOT "/sys/fs/cgroup"
+#define CGROUP1_MEMORY_ROOT "/sys/fs/cgroup/memory"
+
+// Characters that make a command line need a shell to run it
+#define SHELL_CHARS "|&;<>()$`\\\"'*?[#~\n"
+
+// Words that mean something different to the shell than to PATH lookup
+static const char * shell_words[] = {
+    ".", ":", "!", "{", "}", "alias", "break", "case", "cd", "continue",
+    "do", "done", "elif", "else", "esac", "eval", "exec", "exit", "export",
+    "fi", "for", "if", "read", "readonly", "return", "set", "shift",
+    "source", "then", "times", "trap", "ulimit", "umask", "unset", "until",
+    "wait", "while", NULL
+};
 
 uint64_t last_modification(const char * filename)
+{
+    return last_modification_at(AT_FDCWD, filename);
+}
+
+uint64_t last_modification_at(int dir, const char * filename)
 {
     struct stat statinfo;
-    int ret = stat(filename, &statinfo);
+    int ret = fstatat(dir, filename, &statinfo, 0);
     if (ret < 0)
     {
         // Check if file doesn't exist
@@ -25,19 +63,403 @@ uint64_t last_modification(const char * filename)
     return ((uint64_t) statinfo.st_mtim.tv_sec * 1000000000llu) + statinfo.st_mtim.tv_nsec;
 }
 
-bool execute_recipe(const char ** recipe, unsigned int count, FILE * output,
-        FILE * error, bool dryrun)
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char * p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const unsigned char * p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t val)
 {
-    for (unsigned int i=0; i<count; ++i)
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+// State of a streaming XXH64: four independent lanes consume 32-byte
+// stripes, which lets the compiler keep them in registers in parallel.
+typedef struct xxh64_state
+{
+    uint64_t v[4];
+    uint64_t seed;
+    uint64_t total;
+    unsigned char tail[32];
+    size_t tailsize;
+} xxh64_state;
+
+static void xxh64_init(xxh64_state * s, uint64_t seed)
+{
+    s->v[0] = seed + PRIME64_1 + PRIME64_2;
+    s->v[1] = seed + PRIME64_2;
+    s->v[2] = seed;
+    s->v[3] = seed - PRIME64_1;
+    s->seed = seed;
+    s->total = 0;
+    s->tailsize = 0;
+}
+
+static void xxh64_stripes(xxh64_state * s, const unsigned char * p, size_t count)
+{
+    for (size_t i = 0; i < count; ++i, p += 32)
     {
-        fprintf(output, "%s\n", recipe[i]);
-        if (dryrun)
-            continue;
+        s->v[0] = xxh64_round(s->v[0], read64(p));
+        s->v[1] = xxh64_round(s->v[1], read64(p + 8));
+        s->v[2] = xxh64_round(s->v[2], read64(p + 16));
+        s->v[3] = xxh64_round(s->v[3], read64(p + 24));
+    }
+}
+
+static void xxh64_update(xxh64_state * s, const unsigned char * p, size_t len)
+{
+    s->total += len;
+    if (s->tailsize > 0)
+    {
+        size_t fill = 32 - s->tailsize;
+        if (fill > len)
+            fill = len;
+        memcpy(s->tail + s->tailsize, p, fill);
+        s->tailsize += fill;
+        p += fill;
+        len -= fill;
+        if (s->tailsize < 32)
+            return;
+        xxh64_stripes(s, s->tail, 1);
+        s->tailsize = 0;
+    }
+    xxh64_stripes(s, p, len / 32);
+    p += len / 32 * 32;
+    len %= 32;
+    memcpy(s->tail, p, len);
+    s->tailsize = len;
+}
 
-        if (system(recipe[i]))
-            return false;
-        
+static uint64_t xxh64_digest(const xxh64_state * s)
+{
+    uint64_t h;
+    if (s->total >= 32)
+    {
+        h = rotl64(s->v[0], 1) + rotl64(s->v[1], 7) + rotl64(s->v[2], 12) + rotl64(s->v[3], 18);
+        for (int i = 0; i < 4; ++i)
+            h = xxh64_merge(h, s->v[i]);
     }
+    else
+    {
+        h = s->seed + PRIME64_5;
+    }
+    h += s->total;
+
+    const unsigned char * p = s->tail;
+    size_t len = s->tailsize;
+    while (len >= 8)
+    {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4)
+    {
+        h ^= (uint64_t) read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0)
+    {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        ++p;
+        --len;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t hash_bytes(const void * data, size_t len, uint64_t seed)
+{
+    xxh64_state s;
+    xxh64_init(&s, seed);
+    xxh64_update(&s, data, len);
+    return xxh64_digest(&s);
+}
+
+bool content_hash(const char * filename, uint64_t * hash)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    unsigned char * buf = malloc(HASH_BUFSIZE);
+    xxh64_state s;
+    xxh64_init(&s, 0);
+    ssize_t got;
+    while ((got = read(fd, buf, HASH_BUFSIZE)) != 0)
+    {
+        if (got < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        xxh64_update(&s, buf, got);
+    }
+    close(fd);
+    free(buf);
+    if (got < 0)
+        return false;
+
+    *hash = xxh64_digest(&s);
     return true;
 }
 
+// Splits command into an argv array if it can be run without a shell:
+// no quoting, expansions, redirections or operators, and a first word that
+// isn't a builtin, keyword or variable assignment. Returns NULL otherwise.
+// The result and its words are one allocation, freed with free().
+static char ** split_simple_command(const char * command)
+{
+    if (strpbrk(command, SHELL_CHARS))
+        return NULL;
+
+    size_t len = strlen(command);
+    size_t words = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (command[i] != ' ' && command[i] != '\t' &&
+            (i == 0 || command[i - 1] == ' ' || command[i - 1] == '\t'))
+            words++;
+    }
+    if (words == 0)
+        return NULL;
+
+    char ** argv = malloc((words + 1) * sizeof(char *) + len + 1);
+    char * text = (char *) (argv + words + 1);
+    memcpy(text, command, len + 1);
+
+    size_t count = 0;
+    for (char * word = strtok(text, " \t"); word; word = strtok(NULL, " \t"))
+        argv[count++] = word;
+    argv[count] = NULL;
+
+    bool simple = !strchr(argv[0], '=');
+    for (int i = 0; simple && shell_words[i]; i++)
+    {
+        if (strcmp(argv[0], shell_words[i]) == 0)
+            simple = false;
+    }
+    if (!simple)
+    {
+        free(argv);
+        return NULL;
+    }
+    return argv;
+}
+
+// Starts path (looked up in PATH if search is set) with the arguments argv
+// and no signals blocked, its stdout sent to output and its stderr to error
+// unless they are -1. Returns 0 and sets *pid, or an errno value.
+static int spawn(pid_t * pid, const char * path, char * const argv[], bool search,
+        int output, int error)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    if (output >= 0)
+        posix_spawn_file_actions_adddup2(&actions, output, STDOUT_FILENO);
+    if (error >= 0)
+        posix_spawn_file_actions_adddup2(&actions, error, STDERR_FILENO);
+
+    int err = search ? posix_spawnp(pid, path, &actions, &attr, argv, environ)
+                     : posix_spawn(pid, path, &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return err;
+}
+
+// Starts command with /bin/sh -c
+static pid_t spawn_shell(const char * command, int output, int error)
+{
+    char * const argv[] = { "sh", "-c", (char *) command, NULL };
+    pid_t pid;
+    if (spawn(&pid, "/bin/sh", argv, false, output, error) != 0)
+        return -1;
+    return pid;
+}
+
+pid_t start_command(const char * command, int output, int error)
+{
+    char ** argv = split_simple_command(command);
+    if (argv)
+    {
+        pid_t pid;
+        int err = spawn(&pid, argv[0], argv, true, output, error);
+        free(argv);
+        if (err == 0)
+            return pid;
+        // Let the shell report what went wrong
+    }
+    return spawn_shell(command, output, error);
+}
+
+pid_t start_script_command(const char * script, int output, int error)
+{
+    return spawn_shell(script, output, error);
+}
+
+uint64_t monotonic_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+bool load_average(double * load)
+{
+    FILE * f = fopen("/proc/loadavg", "r");
+    if (!f)
+        return false;
+    bool found = fscanf(f, "%lf", load) == 1;
+    fclose(f);
+    return found;
+}
+
+// Reads the number at the start of the named file. Returns false if there
+// isn't one, which is also how a cgroup without a limit ("max") reads.
+static bool read_number(const char * path, uint64_t * value)
+{
+    FILE * f = fopen(path, "r");
+    if (!f)
+        return false;
+    unsigned long long number;
+    bool found = fscanf(f, "%llu", &number) == 1;
+    fclose(f);
+    if (found)
+        *value = number;
+    return found;
+}
+
+// Lowers *available to the memory left in the cgroup at path, under the
+// controller mounted at root, and in each of its parents. Levels without
+// a limit (or that aren't visible from this cgroup namespace) are skipped.
+static void cgroup_headroom(const char * root, const char * path,
+        const char * limit_file, const char * usage_file, uint64_t * available)
+{
+    size_t rootlen = strlen(root);
+    size_t len = rootlen + strlen(path);
+    char * dir = malloc(len + 1);
+    char * file = malloc(len + strlen(limit_file) + strlen(usage_file) + 2);
+    strcpy(dir, root);
+    strcat(dir, path);
+    while (len > rootlen && dir[len - 1] == '/')
+        dir[--len] = '\0';
+
+    while (true)
+    {
+        uint64_t limit, usage;
+        sprintf(file, "%s/%s", dir, limit_file);
+        bool limited = read_number(file, &limit);
+        sprintf(file, "%s/%s", dir, usage_file);
+        if (limited && read_number(file, &usage))
+        {
+            uint64_t left = limit > usage ? limit - usage : 0;
+            if (left < *available)
+                *available = left;
+        }
+        char * slash = strrchr(dir + rootlen, '/');
+        if (!slash)
+            break;
+        *slash = '\0';
+    }
+    free(file);
+    free(dir);
+}
+
+bool available_memory(uint64_t * bytes)
+{
+    bool found = false;
+    *bytes = UINT64_MAX;
+
+    FILE * f = fopen("/proc/meminfo", "r");
+    if (f)
+    {
+        char line[256];
+        unsigned long long kb;
+        while (fgets(line, sizeof(line), f))
+        {
+            if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1)
+            {
+                *bytes = (uint64_t) kb * 1024;
+                found = true;
+                break;
+            }
+        }
+        fclose(f);
+    }
+
+    // Lines are id:controllers:path, with an empty controller list for
+    // cgroup v2
+    f = fopen("/proc/self/cgroup", "r");
+    if (f)
+    {
+        char line[4096];
+        uint64_t left = UINT64_MAX;
+        while (fgets(line, sizeof(line), f))
+        {
+            line[strcspn(line, "\n")] = '\0';
+            char * controllers = strchr(line, ':');
+            char * path = controllers ? strchr(controllers + 1, ':') : NULL;
+            if (!path)
+                continue;
+            *path++ = '\0';
+            controllers++;
+            if (*controllers == '\0')
+            {
+                cgroup_headroom(CGROUP2_ROOT, path, "memory.max",
+                        "memory.current", &left);
+                continue;
+            }
+            for (char * c = strtok(controllers, ","); c; c = strtok(NULL, ","))
+            {
+                if (strcmp(c, "memory") == 0)
+                    cgroup_headroom(CGROUP1_MEMORY_ROOT, path,
+                            "memory.limit_in_bytes", "memory.usage_in_bytes", &left);
+            }
+        }
+        fclose(f);
+        if (left < *bytes)
+        {
+            *bytes = left;
+            found = true;
+        }
+    }
+    return found;
+}
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 /**
  * Some helper functions for your mymake implementation
@@ -17,11 +18,42 @@
 /// (no permission, etc.).
 uint64_t last_modification(const char * filename);
 
-/// Executes the given recipe. Returns false if one of the commands failed,
-/// true otherwise.
+/// Same as last_modification, but a relative filename is looked up in the
+/// directory open as dir (or the current directory for AT_FDCWD).
+uint64_t last_modification_at(int dir, const char * filename);
+
+/// Return a 64-bit hash (XXH64) of len bytes at data, starting from seed.
+/// Hashes can be chained by passing the previous result as seed.
+uint64_t hash_bytes(const void * data, size_t len, uint64_t seed);
+
+/// Hash the contents of the named file with hash_bytes (seed 0).
 ///
-/// If dryrun == true, only output the commands to output, don't execute them,
-/// and return true.
-bool execute_recipe(const char ** recipe, unsigned int count, FILE * output,
-        FILE * error, bool dryrun);
+/// Returns false if the file couldn't be read.
+bool content_hash(const char * filename, uint64_t * hash);
+
+/// Starts command without waiting for it to finish. Commands made of plain
+/// words are spawned directly; anything else goes through /bin/sh -c, which
+/// is spawned the same way (mymake itself is never forked).
+/// Its stdout goes to the file descriptor output and its stderr to error;
+/// either is inherited if it is -1. The command starts with no signals
+/// blocked. Returns the pid of the new process (to be reaped with waitpid)
+/// or -1 if the process could not be created.
+pid_t start_command(const char * command, int output, int error);
+
+/// Starts script in a single /bin/sh -c. Returns the pid of the shell or
+/// -1, and uses output and error, like start_command.
+pid_t start_script_command(const char * script, int output, int error);
+
+/// Returns the time of a clock that only moves forward, in microseconds.
+/// Only differences between its values are meaningful.
+uint64_t monotonic_us(void);
+
+/// Read the 1 minute load average of the system into load. Returns false
+/// if it isn't available.
+bool load_average(double * load);
 
+/// Read how many bytes of memory can still be used without swapping: the
+/// smaller of what the system has available and what is left under the
+/// memory limits of the cgroup this process is in. Returns false if neither
+/// is known.
+bool available_memory(uint64_t * bytes);
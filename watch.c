@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L
+#include "watch.h"
+#include "strtab.h"
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#define CSIZE 1
+// Events that mean a file's contents or existence changed
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | \
+					  IN_MOVED_FROM | IN_MOVED_TO)
+// A batch of changes ends once nothing happened for this many milliseconds
+#define SETTLE_MS 100
+// Size of the buffer events are read into
+#define EVENT_BUFSIZE (64 * 1024)
+// Initial size of the watch descriptor -> directory array
+#define INITDIRS 16
+
+struct watch_t{
+	int fd;
+	strtab_t * dirs;          // Every directory being watched
+	unsigned int * bywd;      // Directory id of each watch descriptor
+	unsigned int bywdsize;
+	char * path;              // Holds the path passed to the callback
+	size_t pathsize;
+};
+
+watch_t * watch_create(void){
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(fd < 0){
+		return NULL;
+	}
+	watch_t * w = calloc(CSIZE, sizeof(watch_t));
+	w->fd = fd;
+	w->dirs = strtab_create();
+	return w;
+}
+
+void watch_destroy(watch_t * w){
+	close(w->fd);
+	strtab_destroy(w->dirs);
+	free(w->bywd);
+	free(w->path);
+	free(w);
+}
+
+bool watch_add_dir(watch_t * w, const char * dir){
+	size_t len = strlen(dir);
+	if(strtab_find(w->dirs, dir, len) != STRTAB_NONE){
+		return true;
+	}
+	int wd = inotify_add_watch(w->fd, len ? dir : ".", WATCH_EVENTS);
+	if(wd < 0){
+		return false;
+	}
+
+	unsigned int id = strtab_intern(w->dirs, dir, len);
+	if(wd >= w->bywdsize){
+		unsigned int oldsize = w->bywdsize;
+		w->bywdsize = w->bywdsize ? w->bywdsize * 2 : INITDIRS;
+		while(wd >= w->bywdsize){
+			w->bywdsize *= 2;
+		}
+		w->bywd = realloc(w->bywd, w->bywdsize * sizeof(unsigned int));
+		for(unsigned int i = oldsize; i < w->bywdsize; i++){
+			w->bywd[i] = STRTAB_NONE;
+		}
+	}
+	w->bywd[wd] = id;
+	return true;
+}
+
+// Reports one event
+static void report(watch_t * w, const struct inotify_event * ev, watch_cb_t cb,
+				   void * userdata){
+	if(ev->len == 0 || ev->wd < 0 || ev->wd >= w->bywdsize ||
+	   w->bywd[ev->wd] == STRTAB_NONE){
+		return;
+	}
+	const char * dir = strtab_get(w->dirs, w->bywd[ev->wd]);
+	size_t dirlen = strlen(dir);
+	size_t needed = dirlen + strlen(ev->name) + 2;
+	if(needed > w->pathsize){
+		w->pathsize = needed;
+		w->path = realloc(w->path, w->pathsize);
+	}
+	if(dirlen == 0){
+		strcpy(w->path, ev->name);
+	} else if(dir[dirlen - 1] == '/'){
+		snprintf(w->path, needed, "%s%s", dir, ev->name);
+	} else {
+		snprintf(w->path, needed, "%s/%s", dir, ev->name);
+	}
+	cb(userdata, w->path);
+}
+
+// Reports every queued event. Returns the number of events read, or -1 on
+// error.
+static int read_events(watch_t * w, watch_cb_t cb, void * userdata){
+	_Alignas(struct inotify_event) char buf[EVENT_BUFSIZE];
+	int count = 0;
+	while(true){
+		ssize_t len = read(w->fd, buf, sizeof(buf));
+		if(len < 0){
+			if(errno == EAGAIN) return count;
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		for(char * walker = buf; walker < buf + len;){
+			const struct inotify_event * ev = (const struct inotify_event *)walker;
+			report(w, ev, cb, userdata);
+			walker += sizeof(struct inotify_event) + ev->len;
+			count++;
+		}
+	}
+}
+
+bool watch_wait(watch_t * w, watch_cb_t cb, void * userdata){
+	struct pollfd pfd;
+	pfd.fd = w->fd;
+	pfd.events = POLLIN;
+
+	// Block for the first change, then keep going until things settle
+	int timeout = -1;
+	while(true){
+		int ready = poll(&pfd, 1, timeout);
+		if(ready < 0){
+			if(errno == EINTR) continue;
+			return false;
+		}
+		if(ready == 0){
+			return true;
+		}
+		if(read_events(w, cb, userdata) < 0){
+			return false;
+		}
+		timeout = SETTLE_MS;
+	}
+}
+
+void watch_drain(watch_t * w, watch_cb_t cb, void * userdata){
+	read_events(w, cb, userdata);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * Watches directories for changes to the files in them, using inotify.
+ * Changes are reported as paths made of the directory as it was passed to
+ * watch_add_dir and the name of the file in it.
+ */
+
+struct watch_t;
+typedef struct watch_t watch_t;
+
+// Called with the path of every file that changed
+typedef void (*watch_cb_t) (void * userdata, const char * path);
+
+// Returns NULL if inotify can't be used
+watch_t * watch_create(void);
+
+void watch_destroy(watch_t * w);
+
+// Starts watching dir ("" for the current directory). Watching a directory
+// twice does nothing. Returns false if it can't be watched.
+bool watch_add_dir(watch_t * w, const char * dir);
+
+// Waits until a file changes, then reports changes until none have come for
+// a short while, so a burst of writes is reported as one batch. Returns
+// false on error.
+bool watch_wait(watch_t * w, watch_cb_t cb, void * userdata);
+
+// Reports the changes that are already queued, without waiting
+void watch_drain(watch_t * w, watch_cb_t cb, void * userdata);